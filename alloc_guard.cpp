@@ -0,0 +1,143 @@
+/**
+Replacements of the global allocation functions reporting every allocation to AllocGuard, linked in with
+-DORDER_BOOK_ALLOC_GUARD=ON
+**/
+
+#include <cstdlib>
+#include <new>
+
+#include "alloc_guard.h"
+
+using namespace order_book;
+
+namespace
+{
+  void* allocate(std::size_t size)
+  {
+    AllocGuard<>::onAllocation();
+    return std::malloc(size ? size : 1);
+  }
+
+#ifdef __cpp_aligned_new
+  void* allocate(std::size_t size, std::align_val_t alignment)
+  {
+    AllocGuard<>::onAllocation();
+    //aligned_alloc wants a size multiple of the alignment
+    const std::size_t align = static_cast<std::size_t>(alignment);
+    return std::aligned_alloc(align, ((size ? size : 1) + align - 1) & ~(align - 1));
+  }
+#endif
+}
+
+void* operator new(std::size_t size)
+{
+  void* ptr = allocate(size);
+  if(!ptr)
+  {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void* operator new[](std::size_t size)
+{
+  return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+  return allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+  return allocate(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+//over aligned allocations, c++17 and later
+#ifdef __cpp_aligned_new
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+  void* ptr = allocate(size, alignment);
+  if(!ptr)
+  {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+  return operator new(size, alignment);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+  return allocate(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+  return allocate(size, alignment);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+  std::free(ptr);
+}
+#endif
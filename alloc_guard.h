@@ -0,0 +1,100 @@
+#pragma once
+
+#include "utils.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+
+#include <unistd.h>
+
+//counts heap allocations made by the feed thread while it processes a message, compiled in with
+//-DORDER_BOOK_ALLOC_GUARD (cmake -DORDER_BOOK_ALLOC_GUARD=ON) which also links the operator new
+//replacements of alloc_guard.cpp. without it the guard macros expand to nothing
+#ifdef ORDER_BOOK_ALLOC_GUARD
+#define ALLOC_GUARD_BEGIN() ::order_book::AllocGuard<>::arm()
+#define ALLOC_GUARD_END() ::order_book::AllocGuard<>::disarm()
+//allocators that do not go through operator new report their allocations with it
+#define ALLOC_GUARD_ALLOCATION() ::order_book::AllocGuard<>::onAllocation()
+#else
+#define ALLOC_GUARD_BEGIN()
+#define ALLOC_GUARD_END()
+#define ALLOC_GUARD_ALLOCATION()
+#endif
+
+namespace order_book
+{
+  enum class AllocGuardMode : uint8_t
+  {
+    off,
+    //count the allocations made while armed
+    count,
+    //abort on the first allocation made while armed
+    abort
+  };
+
+  template<typename tag_t = void>
+  class AllocGuard
+  {
+    public:
+
+      static void setMode(AllocGuardMode mode)
+      {
+        mode_ = mode;
+      }
+
+      static AllocGuardMode mode()
+      {
+        return mode_;
+      }
+
+      //arming is per thread, allocations of the other threads are never counted
+      static void arm()
+      {
+        armed_ = mode_ != AllocGuardMode::off;
+      }
+
+      static void disarm()
+      {
+        armed_ = false;
+      }
+
+      static uint64_t num_allocations()
+      {
+        return num_allocations_.load(std::memory_order_relaxed);
+      }
+
+      //called by the replaced operator new and by PoolMemory, must not allocate
+      static void onAllocation()
+      {
+        if(LIKELY(!armed_))
+        {
+          return;
+        }
+
+        num_allocations_.fetch_add(1, std::memory_order_relaxed);
+        if(mode_ == AllocGuardMode::abort)
+        {
+          static const char msg[] = "heap allocation on the message path, aborting\n";
+          auto ret = ::write(STDERR_FILENO, msg, sizeof(msg) - 1);
+          (void)ret;
+          std::abort();
+        }
+      }
+
+    private:
+
+      static AllocGuardMode mode_;
+      static thread_local bool armed_;
+      static std::atomic<uint64_t> num_allocations_;
+  };
+
+  template<typename tag_t>
+  AllocGuardMode AllocGuard<tag_t>::mode_ = AllocGuardMode::off;
+
+  template<typename tag_t>
+  thread_local bool AllocGuard<tag_t>::armed_ = false;
+
+  template<typename tag_t>
+  std::atomic<uint64_t> AllocGuard<tag_t>::num_allocations_(0);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "types.h"
+
+#include <cstdio>
+
+namespace order_book
+{
+  constexpr uint32_t kBinaryFeedMagic = 0x4d46424f; //"OBFM"
+  constexpr uint32_t kBinaryFeedVersion = 1;
+
+  //binary feed file: a header followed by fixed size records, native endian
+  //
+  //  [BinaryFeedHeader][BinaryMessage]...
+  //
+  //the fields carry what the text format carries, type and side hold the same characters ('A', 'B', ...)
+  struct BinaryFeedHeader
+  {
+    uint32_t magic = kBinaryFeedMagic;
+    uint32_t version = kBinaryFeedVersion;
+  };
+
+  struct BinaryMessage
+  {
+    price_t price;
+    order_id_t id;
+    qty_t qty;
+    char type;
+    char side;
+    uint8_t pad[6];
+  };
+
+  static_assert(sizeof(BinaryMessage) == 24, "binary messages are fixed 24 byte records");
+
+  inline bool writeBinaryFeedHeader(FILE* file)
+  {
+    BinaryFeedHeader header;
+    return std::fwrite(&header, sizeof(header), 1, file) == 1;
+  }
+
+  inline bool readBinaryFeedHeader(FILE* file)
+  {
+    BinaryFeedHeader header;
+    return std::fread(&header, sizeof(header), 1, file) == 1 &&
+            header.magic == kBinaryFeedMagic && header.version == kBinaryFeedVersion;
+  }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace order_book
+{
+  //sizes a book is presized for at construction, 0 keeps the built in defaults
+  struct BookCapacity
+  {
+    //resting orders across both sides
+    uint64_t max_orders = 0;
+    //price levels on one side
+    uint64_t max_levels = 0;
+
+    BookCapacity scaled(double factor) const
+    {
+      BookCapacity capacity;
+      capacity.max_orders = static_cast<uint64_t>(max_orders * factor);
+      capacity.max_levels = static_cast<uint64_t>(max_levels * factor);
+      return capacity;
+    }
+
+    void merge(const BookCapacity& other)
+    {
+      max_orders = std::max(max_orders, other.max_orders);
+      max_levels = std::max(max_levels, other.max_levels);
+    }
+  };
+
+  //capacity profile, one "<name> <value>" line per field so it can be read and edited by hand
+  //
+  //  max_orders 1200000
+  //  max_levels 850
+  inline bool writeCapacityProfile(const char* path, const BookCapacity& capacity)
+  {
+    FILE* file = std::fopen(path, "w");
+    if(!file)
+    {
+      return false;
+    }
+
+    bool ok = std::fprintf(file, "max_orders %llu\nmax_levels %llu\n",
+                           static_cast<unsigned long long>(capacity.max_orders),
+                           static_cast<unsigned long long>(capacity.max_levels)) > 0;
+    return (std::fclose(file) == 0) && ok;
+  }
+
+  enum class CapacityProfileStatus : uint8_t
+  {
+    loaded,
+    //no profile yet, the first run writes it
+    missing,
+    //not a list of "<name> <value>" lines, the capacity is left untouched
+    malformed
+  };
+
+  //unknown names are skipped so older binaries read newer profiles
+  inline CapacityProfileStatus readCapacityProfile(const char* path, BookCapacity& capacity)
+  {
+    FILE* file = std::fopen(path, "r");
+    if(!file)
+    {
+      return CapacityProfileStatus::missing;
+    }
+
+    BookCapacity read;
+    char name[64];
+    unsigned long long value = 0;
+    int fields = 0;
+    while((fields = std::fscanf(file, "%63s %llu", name, &value)) == 2)
+    {
+      if(std::strcmp(name, "max_orders") == 0)
+      {
+        read.max_orders = value;
+      }
+      else if(std::strcmp(name, "max_levels") == 0)
+      {
+        read.max_levels = value;
+      }
+    }
+
+    std::fclose(file);
+    if(fields != EOF)
+    {
+      return CapacityProfileStatus::malformed;
+    }
+
+    capacity = read;
+    return CapacityProfileStatus::loaded;
+  }
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "utils.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace order_book
+{
+  constexpr uint32_t kCheckpointMagic = 0x4b43424f; //"OBCK"
+  constexpr uint32_t kCheckpointVersion = 2;
+
+  //appends trivially copyable values to an in memory image, native endian
+  class CheckpointWriter
+  {
+    public:
+
+      template<typename T>
+      void put(const T& value)
+      {
+        static_assert(std::is_trivially_copyable<T>::value, "checkpoint fields must be trivially copyable");
+        auto offset = buffer_.size();
+        buffer_.resize(offset + sizeof(T));
+        std::memcpy(&buffer_[offset], &value, sizeof(T));
+      }
+
+      void reserve(size_t size)
+      {
+        buffer_.reserve(size);
+      }
+
+      const char* data() const
+      {
+        return buffer_.data();
+      }
+
+      size_t size() const
+      {
+        return buffer_.size();
+      }
+
+      void clear()
+      {
+        buffer_.clear();
+      }
+
+    private:
+
+      std::vector<char> buffer_;
+  };
+
+  //bounds checked reads over a checkpoint image, every get fails once the image is exhausted
+  class CheckpointReader
+  {
+    public:
+
+      CheckpointReader(const char* data, size_t size) : cur_(data), end_(data + size)
+      {
+      }
+
+      template<typename T>
+      bool get(T& value)
+      {
+        static_assert(std::is_trivially_copyable<T>::value, "checkpoint fields must be trivially copyable");
+        if(UNLIKELY(static_cast<size_t>(end_ - cur_) < sizeof(T)))
+        {
+          cur_ = end_;
+          return false;
+        }
+
+        std::memcpy(&value, cur_, sizeof(T));
+        cur_ += sizeof(T);
+        return true;
+      }
+
+      //number of bytes not read yet
+      size_t remaining() const
+      {
+        return end_ - cur_;
+      }
+
+    private:
+
+      const char* cur_;
+      const char* end_;
+  };
+
+  //the feed file a checkpoint or an index was made from: its size and a hash of its first bytes as stored,
+  //compressed or not. a feed rewritten since then is refused instead of replayed from a stale offset
+  struct FeedIdentity
+  {
+    static constexpr size_t kPrefixSize = 1 << 16;
+
+    uint64_t size = 0;
+    uint64_t prefix_hash = 0;
+
+    bool operator==(const FeedIdentity& other) const
+    {
+      return size == other.size && prefix_hash == other.prefix_hash;
+    }
+
+    bool operator!=(const FeedIdentity& other) const
+    {
+      return !(*this == other);
+    }
+  };
+
+  //fnv-1a over the first kPrefixSize bytes of the file
+  inline bool readFeedIdentity(const char* path, FeedIdentity& identity)
+  {
+    int fd = ::open(path, O_RDONLY);
+    if(fd < 0)
+    {
+      return false;
+    }
+
+    struct stat st;
+    std::vector<unsigned char> prefix(FeedIdentity::kPrefixSize);
+    ssize_t size = -1;
+    if(::fstat(fd, &st) == 0)
+    {
+      size = ::pread(fd, prefix.data(), std::min<uint64_t>(prefix.size(), st.st_size), 0);
+    }
+    ::close(fd);
+    if(size < 0 || static_cast<uint64_t>(size) != std::min<uint64_t>(prefix.size(), st.st_size))
+    {
+      return false;
+    }
+
+    identity.size = st.st_size;
+    identity.prefix_hash = 0xcbf29ce484222325ULL;
+    for(ssize_t i = 0; i < size; ++i)
+    {
+      identity.prefix_hash = (identity.prefix_hash ^ prefix[i]) * 0x100000001b3ULL;
+    }
+    return true;
+  }
+
+  //write the image to a temporary file and rename it over the target, so a crash never leaves a torn checkpoint
+  inline bool writeCheckpointFile(const char* path, const CheckpointWriter& writer)
+  {
+    const std::string temp_path = std::string(path) + ".tmp";
+    FILE* file = std::fopen(temp_path.c_str(), "wb");
+    if(!file)
+    {
+      return false;
+    }
+
+    bool ok = std::fwrite(writer.data(), 1, writer.size(), file) == writer.size();
+    ok = (std::fclose(file) == 0) && ok;
+    if(!ok || std::rename(temp_path.c_str(), path) != 0)
+    {
+      std::remove(temp_path.c_str());
+      return false;
+    }
+
+    return true;
+  }
+
+  //read the whole file with a single fread
+  inline bool readCheckpointFile(const char* path, std::vector<char>& image)
+  {
+    FILE* file = std::fopen(path, "rb");
+    if(!file)
+    {
+      return false;
+    }
+
+    bool ok = std::fseek(file, 0, SEEK_END) == 0;
+    long size = ok ? std::ftell(file) : -1;
+    ok = size >= 0 && std::fseek(file, 0, SEEK_SET) == 0;
+    if(ok)
+    {
+      image.resize(size);
+      ok = std::fread(image.data(), 1, size, file) == static_cast<size_t>(size);
+    }
+
+    std::fclose(file);
+    return ok;
+  }
+}
@@ -0,0 +1,317 @@
+#pragma once
+
+#include "utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+namespace order_book
+{
+  //write the decimal digits of the value, return the number of chars written (at most 20)
+  inline size_t formatUnsigned(char* out, uint64_t value)
+  {
+    char temp[20];
+    size_t len = 0;
+    do
+    {
+      temp[len++] = '0' + (value % 10);
+      value /= 10;
+    } while(value);
+
+    for(size_t i = 0; i < len; ++i)
+    {
+      out[i] = temp[len - 1 - i];
+    }
+
+    return len;
+  }
+
+  //format the double exactly like an ostream with default flags (printf %g), return the number of chars
+  //written (at most 32). prices with up to 4 decimals and 6 significant digits take the fast path
+  inline size_t formatDouble(char* out, double value)
+  {
+    constexpr double kScale = 10000;
+    constexpr int kScaleDigits = 4;
+
+    double scaled = value * kScale;
+    if(LIKELY(std::fabs(scaled) < 1e15 && !(value == 0 && std::signbit(value))))
+    {
+      int64_t n = static_cast<int64_t>(scaled);
+      if(static_cast<double>(n) == scaled)
+      {
+        //scaled is an exact integer so value is within an ulp of n/10^4, which %g rounds back to n/10^4
+        //as long as it has no more than 6 significant digits
+        size_t len = 0;
+        if(n < 0)
+        {
+          out[len++] = '-';
+          n = -n;
+        }
+
+        uint64_t mantissa = n;
+        int exponent = -kScaleDigits;
+        while(mantissa && mantissa % 10 == 0)
+        {
+          mantissa /= 10;
+          ++exponent;
+        }
+
+        char digits[20];
+        size_t num_digits = formatUnsigned(digits, mantissa);
+        int decimal_exponent = static_cast<int>(num_digits) - 1 + exponent;
+        if(num_digits <= 6 && decimal_exponent < 6)
+        {
+          if(mantissa == 0)
+          {
+            out[len++] = '0';
+          }
+          else if(exponent >= 0)
+          {
+            std::memcpy(out + len, digits, num_digits);
+            len += num_digits;
+            std::memset(out + len, '0', exponent);
+            len += exponent;
+          }
+          else if(decimal_exponent >= 0)
+          {
+            size_t int_digits = decimal_exponent + 1;
+            std::memcpy(out + len, digits, int_digits);
+            len += int_digits;
+            out[len++] = '.';
+            std::memcpy(out + len, digits + int_digits, num_digits - int_digits);
+            len += num_digits - int_digits;
+          }
+          else
+          {
+            out[len++] = '0';
+            out[len++] = '.';
+            std::memset(out + len, '0', -decimal_exponent - 1);
+            len += -decimal_exponent - 1;
+            std::memcpy(out + len, digits, num_digits);
+            len += num_digits;
+          }
+
+          return len;
+        }
+      }
+    }
+
+    return std::snprintf(out, 32, "%g", value);
+  }
+
+  //formats text into a ring of preallocated buffers and hands the full ones to a background thread
+  //which drains them to the file descriptor with large write(2) calls
+  //the stream operators produce the same bytes as a std::ostream with default flags
+  class AsyncBookWriter
+  {
+    public:
+
+      AsyncBookWriter(int fd, size_t buffer_size = 1 << 16, size_t num_buffers = 8) :
+                      fd_(fd), buffer_size_(buffer_size), buffers_(num_buffers), lengths_(num_buffers, 0)
+      {
+        assert(buffer_size_ >= kMaxToken && num_buffers > 1);
+        for(auto& buffer : buffers_)
+        {
+          buffer.reset(new char[buffer_size_]);
+        }
+
+        cur_ = buffers_[0].get();
+        end_ = cur_ + buffer_size_;
+
+        thread_ = std::thread([this]() { run(); });
+      }
+
+      AsyncBookWriter(const AsyncBookWriter&) = delete;
+      AsyncBookWriter& operator=(const AsyncBookWriter&) = delete;
+
+      ~AsyncBookWriter()
+      {
+        flush();
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          stop_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+      }
+
+      AsyncBookWriter& operator<<(const char* str)
+      {
+        return write(str, std::strlen(str));
+      }
+
+      AsyncBookWriter& operator<<(char c)
+      {
+        *reserve(1) = c;
+        ++cur_;
+        return *this;
+      }
+
+      AsyncBookWriter& operator<<(uint64_t value)
+      {
+        cur_ += formatUnsigned(reserve(20), value);
+        return *this;
+      }
+
+      AsyncBookWriter& operator<<(uint32_t value)
+      {
+        return *this << static_cast<uint64_t>(value);
+      }
+
+      AsyncBookWriter& operator<<(int value)
+      {
+        if(value < 0)
+        {
+          *this << '-';
+          return *this << static_cast<uint64_t>(-static_cast<int64_t>(value));
+        }
+
+        return *this << static_cast<uint64_t>(value);
+      }
+
+      AsyncBookWriter& operator<<(double value)
+      {
+        cur_ += formatDouble(reserve(32), value);
+        return *this;
+      }
+
+      AsyncBookWriter& write(const char* data, size_t len)
+      {
+        while(len)
+        {
+          size_t chunk = std::min<size_t>(len, end_ - cur_);
+          std::memcpy(cur_, data, chunk);
+          cur_ += chunk;
+          data += chunk;
+          len -= chunk;
+          if(cur_ == end_)
+          {
+            submit();
+          }
+        }
+
+        return *this;
+      }
+
+      //hand over the partially filled buffer and wait until everything is written out
+      void flush()
+      {
+        if(cur_ != buffers_[head_ % buffers_.size()].get())
+        {
+          submit();
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return tail_ == head_; });
+      }
+
+      //bytes the background thread failed to write, errors are not retried
+      uint64_t num_failed_bytes() const
+      {
+        return num_failed_bytes_.load(std::memory_order_relaxed);
+      }
+
+    private:
+
+      //longest formatted number
+      static constexpr size_t kMaxToken = 32;
+
+      char* reserve(size_t len)
+      {
+        if(UNLIKELY(cur_ + len > end_))
+        {
+          submit();
+        }
+
+        return cur_;
+      }
+
+      void submit()
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto current = head_ % buffers_.size();
+        lengths_[current] = cur_ - buffers_[current].get();
+        ++head_;
+        cv_.notify_all();
+
+        //the next buffer is free once the writer thread is less than a full ring behind
+        cv_.wait(lock, [this]() { return head_ - tail_ < buffers_.size(); });
+        cur_ = buffers_[head_ % buffers_.size()].get();
+        end_ = cur_ + buffer_size_;
+      }
+
+      void run()
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while(true)
+        {
+          cv_.wait(lock, [this]() { return stop_ || tail_ != head_; });
+          if(tail_ == head_)
+          {
+            return;
+          }
+
+          auto index = tail_ % buffers_.size();
+          lock.unlock();
+          writeAll(buffers_[index].get(), lengths_[index]);
+          lock.lock();
+
+          ++tail_;
+          cv_.notify_all();
+        }
+      }
+
+      void writeAll(const char* data, size_t len)
+      {
+        while(len)
+        {
+          auto ret = ::write(fd_, data, len);
+          if(ret < 0)
+          {
+            if(errno == EINTR)
+            {
+              continue;
+            }
+            num_failed_bytes_.fetch_add(len, std::memory_order_relaxed);
+            return;
+          }
+
+          data += ret;
+          len -= ret;
+        }
+      }
+
+    private:
+
+      int fd_;
+      size_t buffer_size_;
+      std::vector<std::unique_ptr<char[]>> buffers_;
+      std::vector<size_t> lengths_;
+
+      //producer side cursor into the buffer being filled
+      char* cur_ = nullptr;
+      char* end_ = nullptr;
+
+      //buffers [tail_, head_) are queued for the writer thread, both guarded by mutex_
+      uint64_t head_ = 0;
+      uint64_t tail_ = 0;
+      bool stop_ = false;
+      std::mutex mutex_;
+      std::condition_variable cv_;
+      std::atomic<uint64_t> num_failed_bytes_ = {0};
+
+      std::thread thread_;
+  };
+}
@@ -0,0 +1,246 @@
+#pragma once
+
+#include "order_book.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace order_book
+{
+  constexpr uint32_t kNoVenue = std::numeric_limits<uint32_t>::max();
+
+  //consolidated view of one instrument quoted on several venues, one OrderBook per venue
+  //each side keeps a tournament tree over the venues' best prices: a top of book change of one venue replays
+  //the matches on its path to the root, so the consolidated touch costs O(log venues) per change and reading it
+  //is O(1). equal prices go to the lower venue index. depth is merged on demand from the venue books
+  template<typename book_t>
+  class ConsolidatedBook
+  {
+    public:
+
+      explicit ConsolidatedBook(uint32_t max_venues) : max_venues_(max_venues)
+      {
+        assert(max_venues > 0);
+        while(num_leaves_ < max_venues)
+        {
+          num_leaves_ <<= 1;
+        }
+
+        for(auto side : {SideType::bid, SideType::ask})
+        {
+          tree_[static_cast<int>(side)].assign(2 * num_leaves_, kNoVenue);
+          prices_[static_cast<int>(side)].assign(num_leaves_, emptyPrice(side));
+        }
+      }
+
+      ConsolidatedBook(const ConsolidatedBook&) = delete;
+      ConsolidatedBook& operator=(const ConsolidatedBook&) = delete;
+
+      ~ConsolidatedBook()
+      {
+        for(auto& venue : venues_)
+        {
+          venue->book.set_listener(nullptr);
+        }
+      }
+
+      //subscribe to the book's top of book changes, return its venue index or kNoVenue once max_venues are added
+      uint32_t add_venue(book_t& book)
+      {
+        if(UNLIKELY(venues_.size() >= max_venues_))
+        {
+          return kNoVenue;
+        }
+
+        uint32_t index = venues_.size();
+        venues_.emplace_back(new Venue(*this, book, index));
+        book.set_listener(venues_.back().get());
+
+        for(auto side : {SideType::bid, SideType::ask})
+        {
+          update(side, index, book.get_tob(side));
+        }
+        return index;
+      }
+
+      size_t num_venues() const
+      {
+        return venues_.size();
+      }
+
+      book_t& venue_book(uint32_t venue)
+      {
+        return venues_[venue]->book;
+      }
+
+      //venue at the consolidated touch, kNoVenue when no venue quotes the side
+      uint32_t best_venue(SideType side) const
+      {
+        auto venue = tree_[static_cast<int>(side)][1];
+        if(venue == kNoVenue || prices_[static_cast<int>(side)][venue] == emptyPrice(side))
+        {
+          return kNoVenue;
+        }
+        return venue;
+      }
+
+      //consolidated best price, NaN when no venue quotes the side
+      price_t best_price(SideType side) const
+      {
+        auto venue = best_venue(side);
+        return venue == kNoVenue ? std::numeric_limits<double>::quiet_NaN() : prices_[static_cast<int>(side)][venue];
+      }
+
+      //call func(venue) for every venue quoting the consolidated best price, O(venues)
+      template<typename func_t>
+      void visit_touch_venues(SideType side, func_t&& func) const
+      {
+        auto venue = best_venue(side);
+        if(venue == kNoVenue)
+        {
+          return;
+        }
+
+        auto& prices = prices_[static_cast<int>(side)];
+        for(uint32_t i = 0; i < venues_.size(); ++i)
+        {
+          if(prices[i] == prices[venue])
+          {
+            func(i);
+          }
+        }
+      }
+
+      //quantity at the consolidated best price summed over the venues quoting it
+      uint64_t best_qty(SideType side) const
+      {
+        uint64_t total = 0;
+        visit_touch_venues(side, [this, side, &total](uint32_t venue)
+        {
+          venues_[venue]->book.visit_levels(side, 1, [&total](price_t, uint64_t qty) { total += qty; });
+        });
+        return total;
+      }
+
+      //call func(price, qty) for up to depth consolidated levels from the touch, each the sum of the venues'
+      //levels at that price. merges the top depth levels of every venue, O(venues * depth * log)
+      template<typename func_t>
+      size_t visit_levels(SideType side, size_t depth, func_t&& func)
+      {
+        merge_buffer_.clear();
+        for(auto& venue : venues_)
+        {
+          venue->book.visit_levels(side, depth, [this](price_t price, uint64_t qty)
+          {
+            merge_buffer_.emplace_back(price, qty);
+          });
+        }
+
+        if(side == SideType::bid)
+        {
+          std::sort(merge_buffer_.begin(), merge_buffer_.end(),
+                [](const level_t& lhs, const level_t& rhs) { return lhs.first > rhs.first; });
+        }
+        else
+        {
+          std::sort(merge_buffer_.begin(), merge_buffer_.end(),
+                [](const level_t& lhs, const level_t& rhs) { return lhs.first < rhs.first; });
+        }
+
+        size_t count = 0;
+        size_t i = 0;
+        while(i < merge_buffer_.size() && count < depth)
+        {
+          auto price = merge_buffer_[i].first;
+          uint64_t qty = 0;
+          for(; i < merge_buffer_.size() && merge_buffer_[i].first == price; ++i)
+          {
+            qty += merge_buffer_[i].second;
+          }
+          func(price, qty);
+          ++count;
+        }
+
+        return count;
+      }
+
+    private:
+
+      struct Venue : BookListener
+      {
+        Venue(ConsolidatedBook& _owner, book_t& _book, uint32_t _index) : owner(_owner), book(_book), index(_index)
+        {
+        }
+
+        void on_top_changed(SideType side, price_t price) override
+        {
+          owner.update(side, index, price);
+        }
+
+        ConsolidatedBook& owner;
+        book_t& book;
+        uint32_t index;
+      };
+
+      //an empty side loses every match
+      static price_t emptyPrice(SideType side)
+      {
+        return side == SideType::bid ? -std::numeric_limits<double>::infinity()
+                                     : std::numeric_limits<double>::infinity();
+      }
+
+      //winner of the match between two leaves or subtrees
+      uint32_t match(SideType side, uint32_t lhs, uint32_t rhs) const
+      {
+        if(lhs == kNoVenue || rhs == kNoVenue)
+        {
+          return lhs == kNoVenue ? rhs : lhs;
+        }
+
+        auto& prices = prices_[static_cast<int>(side)];
+        if(prices[lhs] == prices[rhs])
+        {
+          return std::min(lhs, rhs);
+        }
+
+        if(side == SideType::bid)
+        {
+          return prices[lhs] > prices[rhs] ? lhs : rhs;
+        }
+        return prices[lhs] < prices[rhs] ? lhs : rhs;
+      }
+
+      void update(SideType side, uint32_t venue, price_t price)
+      {
+        auto& tree = tree_[static_cast<int>(side)];
+        prices_[static_cast<int>(side)][venue] = std::isnan(price) ? emptyPrice(side) : price;
+
+        size_t node = num_leaves_ + venue;
+        tree[node] = venue;
+        while(node > 1)
+        {
+          node >>= 1;
+          tree[node] = match(side, tree[2 * node], tree[2 * node + 1]);
+        }
+      }
+
+    private:
+
+      using level_t = std::pair<price_t, uint64_t>;
+
+      const uint32_t max_venues_;
+      uint32_t num_leaves_ = 1;
+      //implicit binary tree per side, node i has children 2i and 2i + 1, the leaves start at num_leaves_
+      //and every node holds the venue winning its subtree
+      std::vector<uint32_t> tree_[static_cast<int>(SideType::cardinality)];
+      //best price per venue, emptyPrice when the venue does not quote the side
+      std::vector<price_t> prices_[static_cast<int>(SideType::cardinality)];
+      std::vector<std::unique_ptr<Venue>> venues_;
+      std::vector<level_t> merge_buffer_;
+  };
+}
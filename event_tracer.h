@@ -0,0 +1,342 @@
+#pragma once
+
+#include "types.h"
+#include "latency_stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//binary trace of the internal book operations, compiled in with -DORDER_BOOK_TRACE (cmake -DORDER_BOOK_TRACE=ON)
+//and recorded once EventTracer<>::start opened a trace file. decode the file with TraceDecoder
+#ifdef ORDER_BOOK_TRACE
+#define TRACE_EVENT(type, side, id, qty, price) \
+  ::order_book::EventTracer<>::record(::order_book::TraceEventType::type, side, id, qty, price, 0)
+#define TRACE_INVALID(reason, id) \
+  ::order_book::EventTracer<>::record(::order_book::TraceEventType::invalid_msg, ::order_book::SideType::unknown, \
+                                      id, 0, 0, static_cast<uint8_t>(::order_book::InvalidReason::reason))
+#else
+#define TRACE_EVENT(type, side, id, qty, price)
+#define TRACE_INVALID(reason, id)
+#endif
+
+namespace order_book
+{
+  enum class TraceEventType : uint8_t
+  {
+    level_created,
+    level_destroyed,
+    top_changed,
+    order_add,
+    order_amend,
+    order_cancel,
+    invalid_msg,
+    //written by the flusher when a ring overran, qty holds the number of events lost
+    lost
+  };
+
+  //one value per InvalidStats counter
+  enum class InvalidReason : uint8_t
+  {
+    corrupted_msg,
+    duplicate_order,
+    unknown_trade,
+    unknown_mod,
+    crossed,
+    invalid_neg
+  };
+
+  inline const char* ToStr(TraceEventType type)
+  {
+    switch(type)
+    {
+      case TraceEventType::level_created:
+        return "level_created";
+      case TraceEventType::level_destroyed:
+        return "level_destroyed";
+      case TraceEventType::top_changed:
+        return "top_changed";
+      case TraceEventType::order_add:
+        return "order_add";
+      case TraceEventType::order_amend:
+        return "order_amend";
+      case TraceEventType::order_cancel:
+        return "order_cancel";
+      case TraceEventType::invalid_msg:
+        return "invalid_msg";
+      case TraceEventType::lost:
+        return "lost";
+      default:
+        return "unknown";
+    }
+  }
+
+  inline const char* ToStr(InvalidReason reason)
+  {
+    switch(reason)
+    {
+      case InvalidReason::corrupted_msg:
+        return "corrupted_msg";
+      case InvalidReason::duplicate_order:
+        return "duplicate_order";
+      case InvalidReason::unknown_trade:
+        return "unknown_trade";
+      case InvalidReason::unknown_mod:
+        return "unknown_mod";
+      case InvalidReason::crossed:
+        return "crossed";
+      case InvalidReason::invalid_neg:
+        return "invalid_neg";
+      default:
+        return "unknown";
+    }
+  }
+
+  struct TraceEvent
+  {
+    uint64_t tsc;
+    price_t price;
+    order_id_t order_id;
+    qty_t qty;
+    TraceEventType type;
+    SideType side;
+    //InvalidReason of invalid_msg events
+    uint8_t code;
+    uint8_t pad;
+    //index of the recording thread, filled in by the flusher
+    uint32_t thread;
+  };
+
+  static_assert(sizeof(TraceEvent) == 32, "trace events are fixed 32 byte records");
+
+  constexpr uint32_t kTraceMagic = 0x5254424f; //"OBTR"
+  constexpr uint32_t kTraceVersion = 1;
+
+  struct TraceFileHeader
+  {
+    uint32_t magic = kTraceMagic;
+    uint32_t version = kTraceVersion;
+    double cycles_per_ns = 1;
+    uint64_t start_tsc = 0;
+  };
+
+  //single producer ring owned by the recording thread, the producer never waits: when the flusher
+  //falls more than a ring behind the oldest events are overwritten and reported as lost
+  class TraceRing
+  {
+    public:
+
+      static constexpr size_t kCapacity = 1 << 16;
+
+      void record(const TraceEvent& event)
+      {
+        auto head = head_.load(std::memory_order_relaxed);
+        events_[head & (kCapacity - 1)] = event;
+        head_.store(head + 1, std::memory_order_release);
+      }
+
+      //copy the events published since the last drain, return the number of overwritten events
+      uint64_t drain(std::vector<TraceEvent>& out)
+      {
+        auto head = head_.load(std::memory_order_acquire);
+        uint64_t lost = 0;
+        if(head - tail_ > kCapacity)
+        {
+          lost = head - tail_ - kCapacity;
+          tail_ = head - kCapacity;
+        }
+
+        auto offset = out.size();
+        for(auto pos = tail_; pos != head; ++pos)
+        {
+          out.push_back(events_[pos & (kCapacity - 1)]);
+        }
+
+        //slots the producer reused while they were copied are torn, drop them. the producer may also be writing
+        //slot new_head right now, which aliases position new_head - kCapacity
+        std::atomic_thread_fence(std::memory_order_acquire);
+        auto new_head = head_.load(std::memory_order_relaxed);
+        if(new_head + 1 - tail_ > kCapacity)
+        {
+          uint64_t torn = std::min<uint64_t>(new_head + 1 - tail_ - kCapacity, head - tail_);
+          out.erase(out.begin() + offset, out.begin() + offset + torn);
+          lost += torn;
+        }
+
+        tail_ = head;
+        return lost;
+      }
+
+    private:
+
+      std::atomic<uint64_t> head_ = {0};
+      //flusher side
+      uint64_t tail_ = 0;
+      TraceEvent events_[kCapacity];
+  };
+
+  //registry of the per thread rings and the background thread flushing them to the trace file
+  template<typename tag_t = void>
+  class EventTracer
+  {
+    public:
+
+      static bool enabled()
+      {
+        return enabled_.load(std::memory_order_relaxed);
+      }
+
+      static void record(TraceEventType type, SideType side, order_id_t id, qty_t qty, price_t price, uint8_t code)
+      {
+        if(LIKELY(!enabled()))
+        {
+          return;
+        }
+
+        thread_local TraceRing* ring = registerThread();
+        ring->record(TraceEvent{readTsc(), price, id, qty, type, side, code, 0, 0});
+      }
+
+      //open the trace file and start the flusher, flush_interval bounds how long events stay in the rings
+      static bool start(const char* path, std::chrono::microseconds flush_interval = std::chrono::milliseconds(1))
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(file_)
+        {
+          return false;
+        }
+
+        file_ = std::fopen(path, "wb");
+        if(!file_)
+        {
+          return false;
+        }
+
+        TraceFileHeader header;
+        header.cycles_per_ns = tscCyclesPerNs();
+        header.start_tsc = readTsc();
+        std::fwrite(&header, sizeof(header), 1, file_);
+
+        stop_ = false;
+        flusher_ = std::thread([flush_interval]() { run(flush_interval); });
+        enabled_.store(true, std::memory_order_relaxed);
+        return true;
+      }
+
+      //stop recording, write out what is left in the rings and close the file
+      static void stop()
+      {
+        enabled_.store(false, std::memory_order_relaxed);
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if(!file_)
+          {
+            return;
+          }
+          stop_ = true;
+        }
+
+        flusher_.join();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        flush();
+        std::fclose(file_);
+        file_ = nullptr;
+      }
+
+      //events dropped because a ring overran
+      static uint64_t num_lost()
+      {
+        return num_lost_.load(std::memory_order_relaxed);
+      }
+
+    private:
+
+      //rings live until the process exits so the flusher can drain threads that already finished
+      static TraceRing* registerThread()
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rings_.emplace_back(new TraceRing());
+        return rings_.back().get();
+      }
+
+      static void run(std::chrono::microseconds flush_interval)
+      {
+        while(true)
+        {
+          {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(stop_)
+            {
+              return;
+            }
+            flush();
+          }
+          std::this_thread::sleep_for(flush_interval);
+        }
+      }
+
+      //called with mutex_ held
+      static void flush()
+      {
+        for(size_t i = 0; i < rings_.size(); ++i)
+        {
+          buffer_.clear();
+          auto lost = rings_[i]->drain(buffer_);
+          if(lost)
+          {
+            num_lost_.fetch_add(lost, std::memory_order_relaxed);
+            TraceEvent event{readTsc(), 0, 0, static_cast<qty_t>(lost), TraceEventType::lost, SideType::unknown, 0, 0, 0};
+            buffer_.insert(buffer_.begin(), event);
+          }
+
+          for(auto& event : buffer_)
+          {
+            event.thread = i;
+          }
+          std::fwrite(buffer_.data(), sizeof(TraceEvent), buffer_.size(), file_);
+        }
+        std::fflush(file_);
+      }
+
+    private:
+
+      static std::atomic<bool> enabled_;
+      static std::atomic<uint64_t> num_lost_;
+      static std::mutex mutex_;
+      static std::vector<std::unique_ptr<TraceRing>> rings_;
+      static std::vector<TraceEvent> buffer_;
+      static FILE* file_;
+      static bool stop_;
+      static std::thread flusher_;
+  };
+
+  template<typename tag_t>
+  std::atomic<bool> EventTracer<tag_t>::enabled_(false);
+
+  template<typename tag_t>
+  std::atomic<uint64_t> EventTracer<tag_t>::num_lost_(0);
+
+  template<typename tag_t>
+  std::mutex EventTracer<tag_t>::mutex_;
+
+  template<typename tag_t>
+  std::vector<std::unique_ptr<TraceRing>> EventTracer<tag_t>::rings_;
+
+  template<typename tag_t>
+  std::vector<TraceEvent> EventTracer<tag_t>::buffer_;
+
+  template<typename tag_t>
+  FILE* EventTracer<tag_t>::file_ = nullptr;
+
+  template<typename tag_t>
+  bool EventTracer<tag_t>::stop_ = false;
+
+  template<typename tag_t>
+  std::thread EventTracer<tag_t>::flusher_;
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include "message_generator.h"
+#include "binary_message.h"
+#include "book_writer.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace order_book
+{
+  //renders messages into a large buffer handed to fwrite once full
+  class FeedFileWriter
+  {
+    public:
+
+      static constexpr size_t kBufferSize = 1 << 20;
+      //longest text message is 5 fields of at most 32 chars
+      static constexpr size_t kMaxMessageSize = 192;
+
+      FeedFileWriter(FILE* file, bool binary, price_t tick_size) : file_(file), binary_(binary), buffer_(kBufferSize)
+      {
+        //decimals of the tick, prices on the tick grid are then written exactly with that many decimals at most
+        while(price_scale_ < 1e9 && std::fabs(tick_size * price_scale_ - std::round(tick_size * price_scale_)) > 1e-6)
+        {
+          price_scale_ *= 10;
+          ++price_decimals_;
+        }
+      }
+
+      bool write(const Message& msg)
+      {
+        if(UNLIKELY(kBufferSize - size_ < kMaxMessageSize) && !flush())
+        {
+          return false;
+        }
+
+        if(binary_)
+        {
+          writeBinary(msg);
+        }
+        else
+        {
+          writeText(msg);
+        }
+        return true;
+      }
+
+      bool flush()
+      {
+        bool ok = std::fwrite(buffer_.data(), 1, size_, file_) == size_;
+        size_ = 0;
+        return ok;
+      }
+
+    private:
+
+      //A,<id>,<side>,<qty>,<price> for orders, T,<qty>,<price> for trades
+      void writeText(const Message& msg)
+      {
+        //work on a local cursor, stores through the buffer would otherwise reload it after every char
+        char* out = buffer_.data() + size_;
+        char* begin = out;
+        *out++ = static_cast<char>(msg.type);
+        if(msg.corrupt == 1)
+        {
+          //truncated message
+          *out++ = '\n';
+          size_ += out - begin;
+          return;
+        }
+
+        *out++ = ',';
+        if(msg.type != MessageType::trade)
+        {
+          out += formatUnsigned(out, msg.id);
+          *out++ = ',';
+          *out++ = msg.corrupt == 3 ? 'Z' : *ToStr(msg.side);
+          *out++ = ',';
+        }
+
+        if(msg.corrupt == 2)
+        {
+          *out++ = 'x';
+        }
+        else
+        {
+          out += formatUnsigned(out, msg.corrupt == 4 ? 0 : msg.qty);
+        }
+        *out++ = ',';
+        out += formatPrice(out, msg.price);
+        *out++ = '\n';
+        size_ += out - begin;
+      }
+
+      //exact price, strtod reads back the very double the binary format carries. formatDouble is only precise
+      //to 6 significant digits, which would merge close levels of large prices
+      size_t formatPrice(char* out, price_t price)
+      {
+        const double scaled = std::fabs(price) * price_scale_;
+        if(LIKELY(scaled < 1e15))
+        {
+          const uint64_t units = std::llround(scaled);
+          //the decimal units / 10^decimals rounds to the same double as the price
+          if(LIKELY(units / price_scale_ == std::fabs(price)))
+          {
+            char* begin = out;
+            if(price < 0)
+            {
+              *out++ = '-';
+            }
+
+            const uint64_t scale = static_cast<uint64_t>(price_scale_);
+            out += formatUnsigned(out, units / scale);
+            uint64_t fraction = units % scale;
+            if(fraction)
+            {
+              *out++ = '.';
+              int decimals = price_decimals_;
+              while(fraction % 10 == 0)
+              {
+                fraction /= 10;
+                --decimals;
+              }
+              char digits[20];
+              size_t num_digits = formatUnsigned(digits, fraction);
+              for(size_t i = num_digits; i < static_cast<size_t>(decimals); ++i)
+              {
+                *out++ = '0';
+              }
+              std::memcpy(out, digits, num_digits);
+              out += num_digits;
+            }
+            return out - begin;
+          }
+        }
+
+        //off the tick grid, 17 significant digits always read back exactly
+        return std::snprintf(out, 32, "%.17g", price);
+      }
+
+      void writeBinary(const Message& msg)
+      {
+        BinaryMessage record = toBinaryMessage(msg);
+        std::memcpy(&buffer_[size_], &record, sizeof(record));
+        size_ += sizeof(record);
+      }
+
+    private:
+
+      FILE* file_;
+      bool binary_;
+      std::vector<char> buffer_;
+      size_t size_ = 0;
+      double price_scale_ = 1;
+      int price_decimals_ = 0;
+  };
+
+  //prefill plus num_msgs messages of one symbol
+  inline bool generateFeed(const GeneratorConfig& config, uint64_t num_msgs, const char* path, bool binary)
+  {
+    FILE* file = path ? std::fopen(path, "wb") : stdout;
+    if(!file)
+    {
+      return false;
+    }
+
+    MessageGenerator generator(config);
+    FeedFileWriter writer(file, binary, config.tick_size);
+    bool ok = !binary || writeBinaryFeedHeader(file);
+
+    std::vector<Message> resting;
+    generator.prefill(resting);
+    for(size_t i = 0; ok && i < resting.size(); ++i)
+    {
+      ok = writer.write(resting[i]);
+    }
+
+    for(uint64_t i = 0; ok && i < num_msgs; ++i)
+    {
+      ok = writer.write(generator.next());
+    }
+
+    ok = ok && writer.flush();
+    if(path)
+    {
+      ok = (std::fclose(file) == 0) && ok;
+    }
+    else
+    {
+      ok = (std::fflush(file) == 0) && ok;
+    }
+    return ok;
+  }
+}
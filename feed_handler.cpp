@@ -4,240 +4,459 @@ This is the driver main file to get message from file and feed into order book
 
 #include <string>
 #include <iostream>
-#include <fstream>
+#include <cstdlib>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include <sys/stat.h>
 
-#include "order_book.h"
+#include "feed_handler.h"
+#include "book_writer.h"
+#include "replay_index.h"
+#include "alloc_guard.h"
+#include "feed_reader.h"
 
 using namespace order_book;
 
-class FeedHandler
+int main(int argc, char **argv)
 {
-  public:
-    FeedHandler() : order_book_(invalid_stats_)
+  const char* filename = nullptr;
+  const char* shm_name = nullptr;
+  //print the book every N messages, 0 disables the periodic snapshots
+  uint64_t snapshot_interval = 10;
+  const char* checkpoint_path = nullptr;
+  //checkpoint every N messages, 0 only writes the checkpoint at the end of the feed
+  uint64_t checkpoint_interval = 0;
+  const char* restore_path = nullptr;
+  //sidecar replay index, defaults to <feed message file>.idx
+  const char* index_path = nullptr;
+  bool build_index = false;
+  uint64_t index_interval = 1000000;
+  const char* trace_path = nullptr;
+  //feed file written by MessageGen --binary
+  bool binary = false;
+  //presize the book from the high water marks of a previous run and write this run's marks back
+  const char* capacity_path = nullptr;
+  double capacity_headroom = 1.25;
+  AllocGuardMode alloc_guard_mode = AllocGuardMode::off;
+  HugePageMode huge_page_mode = HugePageMode::off;
+  //pin the processing thread, -1 lets it float
+  int cpu = -1;
+  //node the book pools are bound to, defaults to the node of the pinned cpu
+  int numa_node = -1;
+  bool memory_stats = false;
+  bool seek = false;
+  uint64_t seek_msg_number = 0;
+  bool bad_args = false;
+  for(int i = 1; i < argc; ++i)
+  {
+    const std::string arg(argv[i]);
+    if(arg == "--shm" && i + 1 < argc)
+    {
+      shm_name = argv[++i];
+    }
+    else if(arg == "--snapshot-interval" && i + 1 < argc)
+    {
+      snapshot_interval = std::strtoull(argv[++i], nullptr, 10);
+    }
+    else if(arg == "--checkpoint" && i + 1 < argc)
+    {
+      checkpoint_path = argv[++i];
+    }
+    else if(arg == "--checkpoint-interval" && i + 1 < argc)
+    {
+      checkpoint_interval = std::strtoull(argv[++i], nullptr, 10);
+    }
+    else if(arg == "--restore" && i + 1 < argc)
+    {
+      restore_path = argv[++i];
+    }
+    else if(arg == "--index" && i + 1 < argc)
+    {
+      index_path = argv[++i];
+    }
+    else if(arg == "--build-index")
+    {
+      build_index = true;
+    }
+    else if(arg == "--index-interval" && i + 1 < argc)
+    {
+      index_interval = std::strtoull(argv[++i], nullptr, 10);
+    }
+    else if(arg == "--seek" && i + 1 < argc)
+    {
+      seek = true;
+      seek_msg_number = std::strtoull(argv[++i], nullptr, 10);
+    }
+    else if(arg == "--trace" && i + 1 < argc)
     {
+      trace_path = argv[++i];
     }
-    
-    //dispatch the raw message to each handling method
-    void processMessage(const std::string &line)
+    else if(arg == "--binary")
     {
-      if(UNLIKELY(line.size() <= 2 || line[1] != ','))
+      binary = true;
+    }
+    else if(arg == "--capacity-profile" && i + 1 < argc)
+    {
+      capacity_path = argv[++i];
+    }
+    else if(arg == "--capacity-headroom" && i + 1 < argc)
+    {
+      capacity_headroom = std::strtod(argv[++i], nullptr);
+      //a headroom below 1 would presize the book smaller than the profile it was recorded from
+      if(!std::isfinite(capacity_headroom) || capacity_headroom < 1)
+      {
+        bad_args = true;
+      }
+    }
+    else if(arg == "--huge-pages" && i + 1 < argc)
+    {
+      const std::string mode(argv[++i]);
+      if(mode == "off")
       {
-        //invalid short message, should not happen
-        ++ invalid_stats_.num_corrupted_msg;
-        return;
+        huge_page_mode = HugePageMode::off;
       }
-      
-      MessageType msg_type = static_cast<MessageType>(line[0]);
-      const char* msg = line.c_str() + 2;
-      switch(msg_type)
+      else if(mode == "thp")
       {
-        case MessageType::add:
-        {
-          processOrderAdd(msg);
-          break;
-        }
-        case MessageType::mod:
-        {
-          processOrderMod(msg);
-          break;
-        }
-        case MessageType::del:
-        {
-          processOrderDel(msg);
-          break;
-        }
-        case MessageType::trade:
-        {
-          processTrade(msg);
-          break;
-        }
-        default:
-        {
-          //unknown message type, should not happen;
-          std::cout << "Error, unknown message type, skip..." << std::endl;
-          ++ invalid_stats_.num_corrupted_msg;
-        }
+        huge_page_mode = HugePageMode::thp;
+      }
+      else if(mode == "hugetlb")
+      {
+        huge_page_mode = HugePageMode::hugetlb;
+      }
+      else
+      {
+        bad_args = true;
       }
-
     }
-
-    void printCurrentOrderBook(std::ostream &os) const
+    else if(arg == "--cpu" && i + 1 < argc)
     {
-      order_book_.print(os);
-      os << "*** Last trade -> " << last_trade_.second 
-                  << " @ " << last_trade_.first << std::endl;
+      cpu = std::atoi(argv[++i]);
     }
-    
-    void printInvadStat(std::ostream& os) const
+    else if(arg == "--numa-node" && i + 1 < argc)
     {
-      os << "Corrupted Msg : " << invalid_stats_.num_corrupted_msg
-         << " Duplicate Order Id : " << invalid_stats_.num_duplicate_order
-         << " Unknown Trade : " << invalid_stats_.num_unknown_trade
-         << " Unknown order modify or cancel : " << invalid_stats_.num_unknown_mod
-         << " Top of book crossed : " << invalid_stats_.num_crossed
-         << " Invalid Negative Msg Field : " << invalid_stats_.num_invalid_neg << std::endl;
+      numa_node = std::atoi(argv[++i]);
     }
-
-  private:
-    
-    bool processOrderMsg(const char* msg, order_id_t& id, SideType& side, qty_t& qty, price_t& price)
+    else if(arg == "--memory-stats")
+    {
+      memory_stats = true;
+    }
+    else if(arg == "--alloc-guard" && i + 1 < argc)
     {
-      id = parseUnsignedField(msg, ',');
-      if(UNLIKELY(id == std::numeric_limits<uint32_t>::max() || id == 0))
+      const std::string mode(argv[++i]);
+      if(mode == "count")
       {
-        ++ invalid_stats_.num_corrupted_msg;
-        return false;
+        alloc_guard_mode = AllocGuardMode::count;
       }
-
-      ++msg;
-      auto side_char = parseChar(msg, ',');
-      if(!side_char)
+      else if(mode == "abort")
       {
-        ++ invalid_stats_.num_corrupted_msg;
-        return false;
+        alloc_guard_mode = AllocGuardMode::abort;
       }
-
-      side  = ToSide(side_char);
-      if(UNLIKELY(side == SideType::unknown))
+      else
       {
-        ++ invalid_stats_.num_corrupted_msg;
-        return false;
+        bad_args = true;
       }
+    }
+    else if(!filename && arg.compare(0, 2, "--") != 0)
+    {
+      filename = argv[i];
+    }
+    else
+    {
+      bad_args = true;
+    }
+  }
 
-      ++msg;
-      qty = parseUnsignedField(msg, ','); 
-      if(UNLIKELY(qty == std::numeric_limits<uint32_t>::max() || qty == 0))
-      {
-        ++ invalid_stats_.num_corrupted_msg;
-        return false;
-      }
+  if(bad_args || !filename || (build_index && seek) || index_interval == 0 || (binary && (build_index || seek)))
+  {
+    std::cerr << "Usage: " << argv[0] << " <feed message file> [--binary] [--shm <shared memory name>]"
+              << " [--snapshot-interval <messages, 0 to disable>]"
+              << " [--checkpoint <file> [--checkpoint-interval <messages>]] [--restore <file>] [--trace <file>]"
+              << " [--capacity-profile <file> [--capacity-headroom <factor>]] [--alloc-guard count|abort]"
+              << " [--huge-pages off|thp|hugetlb] [--cpu <cpu>] [--numa-node <node>] [--memory-stats]" << std::endl;
+    std::cerr << "       " << argv[0] << " <feed message file> --build-index [--index-interval <messages>] [--index <file>]" << std::endl;
+    std::cerr << "       " << argv[0] << " <feed message file> --seek <message number> [--index <file>]" << std::endl;
+    std::cerr << "text feed files may be gzip, zstd or lz4 compressed" << std::endl;
+    return -1;
+  }
 
-      ++msg;
-      price = parseDouble(msg, '\0');
-      if(UNLIKELY(price == std::numeric_limits<double>::infinity()))
-      {
-        ++ invalid_stats_.num_corrupted_msg;
-        return false;
-      }
+  //the book pools pick up the placement when the first book is constructed
+  if(numa_node < 0 && cpu >= 0)
+  {
+    numa_node = numaNodeOfCpu(cpu);
+  }
+  if(huge_page_mode != HugePageMode::off || numa_node >= 0)
+  {
+    PoolMemory<>::configure(huge_page_mode, numa_node);
+  }
 
-      if(UNLIKELY(price <= 0))
-      {
-        ++ invalid_stats_.num_invalid_neg;
-        return false;
-      }
+  const std::string default_index_path = std::string(filename) + ".idx";
+  if(!index_path)
+  {
+    index_path = default_index_path.c_str();
+  }
 
-      return true;
+  if(build_index)
+  {
+    if(!ReplayIndex::build(filename, index_path, index_interval))
+    {
+      std::cerr << "Failed to build replay index " << index_path << std::endl;
+      return -1;
     }
+    return 0;
+  }
 
-    void processOrderAdd(const char* msg)
+  if(seek)
+  {
+    //print the book as it was right after the requested message
+    ReplayIndex index;
+    if(!index.open(index_path))
     {
-      order_id_t order_id = 0;
-      SideType side = SideType::unknown;
-      qty_t qty = 0;
-      price_t price = 0;
+      std::cerr << "Failed to open replay index " << index_path << ", build it with --build-index" << std::endl;
+      return -1;
+    }
 
-      if(LIKELY(processOrderMsg(msg, order_id, side, qty, price)))
-      {
-        //std::cout << "processOrderAdd: " << order_id << " " << ToStr(side) << " " << qty << " @ " << price << std::endl;
-        order_book_.add_order(order_id, side, qty, price);   
-      }
+    if(!index.matches(filename))
+    {
+      std::cerr << "Replay index " << index_path << " was built from another version of " << filename
+                << ", rebuild it with --build-index" << std::endl;
+      return -1;
+    }
 
+    FeedHandler feed;
+    if(!index.seek(filename, seek_msg_number, feed))
+    {
+      std::cerr << "Failed to seek to message " << seek_msg_number << " of " << index.num_msgs() << std::endl;
+      return -1;
     }
 
-    void processOrderMod(const char* msg)
-    { 
-      order_id_t order_id = 0;
-      SideType side = SideType::unknown;
-      qty_t qty = 0;
-      price_t price = 0;
+    feed.printCurrentOrderBook(std::cout);
+    feed.printInvadStat(std::cout);
+    return 0;
+  }
 
-      if(LIKELY(processOrderMsg(msg, order_id, side, qty, price)))
-      {
-        //std::cout << "processOrderMod: " << order_id << " " << ToStr(side) << " " << qty << " @ " << price << std::endl;
-        order_book_.amend_order(order_id, side, qty, price);   
-      }
+  BookCapacity capacity;
+  //high water marks of the previous runs, merged into this run's ones when the profile is written back so a
+  //quieter feed does not shrink it
+  BookCapacity profile;
+  if(capacity_path)
+  {
+    if(readCapacityProfile(capacity_path, profile) == CapacityProfileStatus::malformed)
+    {
+      std::cerr << "Malformed capacity profile " << capacity_path << std::endl;
+      return -1;
     }
-    
-    void processOrderDel(const char* msg)
+    capacity = profile.scaled(capacity_headroom);
+  }
+
+  //checkpoints are only valid for the feed file they were taken on
+  FeedIdentity feed_identity;
+  if((restore_path || checkpoint_path) && !readFeedIdentity(filename, feed_identity))
+  {
+    std::cerr << "Failed to open feed file " << filename << std::endl;
+    return -1;
+  }
+
+  FeedHandler feed(capacity);
+  uint64_t feed_offset = 0;
+  if(restore_path && !feed.loadCheckpoint(restore_path, feed_offset, feed_identity))
+  {
+    std::cerr << "Failed to restore checkpoint " << restore_path << ", or it was taken on another version of "
+              << filename << std::endl;
+    return -1;
+  }
+
+  ShmBookWriter shm_writer;
+  if(shm_name)
+  {
+    if(!shm_writer.open(shm_name, 1))
     {
-      order_id_t order_id = 0;
-      SideType side = SideType::unknown;
-      qty_t qty = 0;
-      price_t price = 0;
+      std::cerr << "Failed to create shared memory book " << shm_name << std::endl;
+      return -1;
+    }
+    feed.enableShmPublish(shm_writer, 0);
+  }
+
+  //book snapshots are formatted into buffers drained to stderr by a background thread
+  AsyncBookWriter book_writer(STDERR_FILENO);
+
+#ifdef ORDER_BOOK_LATENCY_STATS
+  LatencyRegistry<>::installSignalHandler();
+#endif
+
+  if(alloc_guard_mode != AllocGuardMode::off)
+  {
+#ifdef ORDER_BOOK_ALLOC_GUARD
+    AllocGuard<>::setMode(alloc_guard_mode);
+#else
+    std::cerr << "The allocation guard is not compiled in, rebuild with -DORDER_BOOK_ALLOC_GUARD=ON" << std::endl;
+    return -1;
+#endif
+  }
 
-      if(LIKELY(processOrderMsg(msg, order_id, side, qty, price)))
+  if(trace_path)
+  {
+#ifdef ORDER_BOOK_TRACE
+    if(!EventTracer<>::start(trace_path))
+    {
+      std::cerr << "Failed to open trace file " << trace_path << std::endl;
+      return -1;
+    }
+#else
+    std::cerr << "Tracing is not compiled in, rebuild with -DORDER_BOOK_TRACE=ON" << std::endl;
+    return -1;
+#endif
+  }
+
+  //pin once every helper thread is started so they keep the default affinity
+  if(cpu >= 0 && !pinCurrentThread(cpu))
+  {
+    std::cerr << "Failed to pin the processing thread to cpu " << cpu << std::endl;
+    return -1;
+  }
+
+  uint64_t counter = feed.numMessages();
+  //false once a periodic checkpoint could not be written, the run still ends with a nonzero status
+  bool checkpoint_ok = true;
+  auto on_message = [&]()
+  {
+    ++counter;
+    if (snapshot_interval && counter % snapshot_interval == 0) {
+      feed.printCurrentOrderBook(book_writer);
+    }
+    if (checkpoint_path && checkpoint_interval && counter % checkpoint_interval == 0 &&
+          !feed.saveCheckpoint(checkpoint_path, feed_offset, feed_identity)) {
+      std::cerr << "Failed to write checkpoint " << checkpoint_path << std::endl;
+      checkpoint_ok = false;
+    }
+#ifdef ORDER_BOOK_LATENCY_STATS
+    LatencyRegistry<>::dumpIfRequested(book_writer);
+#endif
+  };
+
+  //false once the feed could not be read to its end
+  bool feed_ok = true;
+  if(binary)
+  {
+    FILE* file = std::fopen(filename, "rb");
+    if(!file || !readBinaryFeedHeader(file))
+    {
+      std::cerr << "Not a binary feed file " << filename << std::endl;
+      return -1;
+    }
+
+    if(feed_offset)
+    {
+      //a checkpoint of another feed would resume past its end or in the middle of a message
+      struct stat st;
+      if(::fstat(::fileno(file), &st) != 0 || feed_offset < sizeof(BinaryFeedHeader) ||
+            feed_offset > static_cast<uint64_t>(st.st_size) ||
+            (feed_offset - sizeof(BinaryFeedHeader)) % sizeof(BinaryMessage) != 0 ||
+            std::fseek(file, feed_offset, SEEK_SET) != 0)
       {
-        //std::cout << "processOrderCancel: " << order_id << " " << ToStr(side) << " " << qty << " @ " << price << std::endl;
-        order_book_.cancel_order(order_id);   
+        std::cerr << "Checkpoint offset " << feed_offset << " is not a message boundary of " << filename << std::endl;
+        std::fclose(file);
+        return -1;
       }
     }
+    else
+    {
+      feed_offset = sizeof(BinaryFeedHeader);
+    }
 
-    void processTrade(const char* msg)
+    std::vector<BinaryMessage> msgs(4096);
+    size_t count = 0;
+    while((count = std::fread(msgs.data(), sizeof(BinaryMessage), msgs.size(), file)) > 0)
     {
-      auto qty = parseUnsignedField(msg, ','); 
-      if(UNLIKELY(qty == std::numeric_limits<uint32_t>::max()))
+      for(size_t i = 0; i < count; ++i)
       {
-        ++ invalid_stats_.num_corrupted_msg;
-        return;
+        ALLOC_GUARD_BEGIN();
+        feed.processMessage(msgs[i]);
+        ALLOC_GUARD_END();
+        feed_offset += sizeof(BinaryMessage);
+        on_message();
       }
+    }
 
-      ++msg;
+    if(std::ferror(file))
+    {
+      std::cerr << "Failed to read binary feed file " << filename << std::endl;
+      feed_ok = false;
+    }
+    std::fclose(file);
+  }
+  else
+  {
+    //gzip, zstd and lz4 captures are decompressed by the reader thread, offsets stay in uncompressed bytes
+    FeedReader reader;
+    if(!reader.open(filename, feed_offset))
+    {
+      std::cerr << "Failed to open feed file " << filename << " at offset " << feed_offset << std::endl;
+      return -1;
+    }
 
-      auto price = parseDouble(msg, '\0');
-      if(UNLIKELY(price == std::numeric_limits<double>::infinity()))
-      {
-        ++ invalid_stats_.num_corrupted_msg;
-        return;
-      }
+    const char* line = nullptr;
+    size_t size = 0;
+    while(reader.next_line(line, size))
+    {
+      ALLOC_GUARD_BEGIN();
+      feed.processMessage(line, size);
+      ALLOC_GUARD_END();
+      feed_offset = reader.offset();
+      on_message();
+    }
 
-      if(UNLIKELY(price <= 0))
-      {
-        ++ invalid_stats_.num_invalid_neg;
-        return;
-      }
-      
-      //std::cout << "processTrade: " << qty << " @ " << price << std::endl;
-      if(price == last_trade_.first)
-      {
-        last_trade_.second += qty;
-      }
-      else
-      {
-        last_trade_.first = price;
-        last_trade_.second = qty;
-      }
+    if(!reader.ok())
+    {
+      std::cerr << "Failed to read " << ToStr(reader.compression()) << " feed file " << filename << std::endl;
+      feed_ok = false;
     }
+  }
+  
+  feed.printCurrentOrderBook(book_writer);
+#ifdef ORDER_BOOK_LATENCY_STATS
+  LatencyRegistry<>::dump(book_writer);
+#endif
+  book_writer.flush();
+  feed.printInvadStat(std::cout);
+
+#ifdef ORDER_BOOK_ALLOC_GUARD
+  if(alloc_guard_mode != AllocGuardMode::off)
+  {
+    std::cerr << "Heap allocations while processing messages : " << AllocGuard<>::num_allocations() << std::endl;
+  }
+#endif
 
-  private:
-    InvalidStats invalid_stats_;
-    OrderBook<boost::object_pool<Order>, 
-        boost::object_pool<PriceLevel>> order_book_;
-    std::pair<price_t, qty_t> last_trade_= {0,0};
-};
+  if(memory_stats)
+  {
+    printPoolMemoryStats(std::cerr);
+  }
 
-int main(int argc, char **argv)
-{
-  if(argc != 2)
+  if(!feed_ok)
   {
-    std::cerr << "Usage: " << argv[0] << " <feed message file>" << std::endl;
+#ifdef ORDER_BOOK_TRACE
+    EventTracer<>::stop();
+#endif
+    //the book only covers part of the feed, keep the previous capacity profile and checkpoint
     return -1;
   }
 
-  FeedHandler feed;
-  std::string line;
-  const std::string filename(argv[1]);
-  std::ifstream infile(filename.c_str(), std::ios::in);
-  int counter = 0;
-  while (std::getline(infile, line)) 
+  profile.merge(feed.capacityHighWater());
+  if(capacity_path && !writeCapacityProfile(capacity_path, profile))
   {
-    feed.processMessage(line);
-    if (++counter % 10 == 0) {
-      feed.printCurrentOrderBook(std::cerr);
-    }
+    std::cerr << "Failed to write capacity profile " << capacity_path << std::endl;
+    return -1;
+  }
+
+#ifdef ORDER_BOOK_TRACE
+  EventTracer<>::stop();
+#endif
+
+  if(checkpoint_path && !feed.saveCheckpoint(checkpoint_path, feed_offset, feed_identity))
+  {
+    std::cerr << "Failed to write checkpoint " << checkpoint_path << std::endl;
+    return -1;
   }
-  
-  feed.printCurrentOrderBook(std::cerr);
-  feed.printInvadStat(std::cout);
 
-  return 0;
+  return checkpoint_ok ? 0 : -1;
 }
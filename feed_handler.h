@@ -0,0 +1,565 @@
+#pragma once
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#include "order_book.h"
+#include "binary_message.h"
+#include "shm_book.h"
+#include "snapshot_buffer.h"
+#include "latency_stats.h"
+#include "event_tracer.h"
+
+namespace order_book
+{
+  //parses the feed messages and applies them to the order book
+  class FeedHandler
+  {
+    public:
+      explicit FeedHandler(const BookCapacity& capacity = BookCapacity()) : order_book_(invalid_stats_, capacity)
+      {
+      }
+    
+      //publish the book into the shared memory slot after every message from now on
+      void enableShmPublish(ShmBookWriter& writer, uint32_t book)
+      {
+        shm_writer_ = &writer;
+        shm_book_ = book;
+        publishSnapshot();
+      }
+
+      //publish the book to reader threads of this process after every message from now on
+      void enableLocalPublish(BookSnapshotBuffer& buffer)
+      {
+        snapshot_buffer_ = &buffer;
+        publishSnapshot();
+      }
+
+      void processMessage(const std::string &line)
+      {
+        processMessage(line.c_str(), line.size());
+      }
+
+      //line without its newline, must be NUL terminated as the field parsers stop on it
+      void processMessage(const char* line, size_t size)
+      {
+        dispatchMessage(line, size);
+        ++ num_msgs_;
+
+        if(shm_writer_ || snapshot_buffer_)
+        {
+          publishSnapshot();
+        }
+      }
+
+      //nodes found by prefetchLookup, followed by prefetchLinks and handed to processMessage
+      struct MessagePrefetch
+      {
+        order_lookup_t order_iter;
+        const Order* order = nullptr;
+        PriceLevel* level = nullptr;
+      };
+
+      //prefetch is what prefetchLookup returned for the message, nullptr to look the nodes up here
+      void processMessage(const BinaryMessage& msg, const MessagePrefetch* prefetch = nullptr)
+      {
+        dispatchMessage(msg, prefetch);
+        ++ num_msgs_;
+
+        if(shm_writer_ || snapshot_buffer_)
+        {
+          publishSnapshot();
+        }
+      }
+
+      //first prefetch stage of a message, the index and level lookups. the caller is expected to work on other
+      //books before prefetchLinks and processMessage, which reuses the lookups, so the prefetched nodes have
+      //arrived. the book must not change in between
+      void prefetchLookup(const BinaryMessage& msg, MessagePrefetch& prefetch) const
+      {
+        prefetch = MessagePrefetch();
+        switch(static_cast<MessageType>(msg.type))
+        {
+          case MessageType::add:
+          {
+            order_book_.prefetch_order(msg.id, prefetch.order_iter);
+            prefetch.level = order_book_.prefetch_level(ToSide(msg.side), msg.price);
+            break;
+          }
+          case MessageType::mod:
+          {
+            prefetch.order = order_book_.prefetch_order(msg.id, prefetch.order_iter);
+            prefetch.level = order_book_.prefetch_level(ToSide(msg.side), msg.price);
+            break;
+          }
+          case MessageType::del:
+          {
+            prefetch.order = order_book_.prefetch_order(msg.id, prefetch.order_iter);
+            break;
+          }
+          default:
+            break;
+        }
+      }
+
+      //second prefetch stage, the list neighbours the message relinks
+      void prefetchLinks(const MessagePrefetch& prefetch) const
+      {
+        order_book_.prefetch_order_links(prefetch.order);
+        order_book_.prefetch_level_tail(prefetch.level);
+      }
+
+      uint64_t numMessages() const
+      {
+        return num_msgs_;
+      }
+
+      BookCapacity capacityHighWater() const
+      {
+        return order_book_.high_water();
+      }
+
+      //feed_offset is where the feed has to resume to continue after the checkpointed state, in the feed file
+      //identified by feed
+      void saveCheckpoint(CheckpointWriter& writer, uint64_t feed_offset, const FeedIdentity& feed) const
+      {
+        writer.put(kCheckpointMagic);
+        writer.put(kCheckpointVersion);
+        writer.put(feed);
+        writer.put(feed_offset);
+        writer.put(num_msgs_);
+        writer.put(invalid_stats_);
+        writer.put(last_trade_.first);
+        writer.put(last_trade_.second);
+        order_book_.save_checkpoint(writer);
+      }
+
+      //restore a freshly constructed handler, on failure the handler must be discarded. a checkpoint taken on
+      //another feed file than feed is refused, its offset would not fall on a message of this one
+      bool loadCheckpoint(CheckpointReader& reader, uint64_t& feed_offset, const FeedIdentity& feed)
+      {
+        uint32_t magic = 0;
+        uint32_t version = 0;
+        FeedIdentity checkpoint_feed;
+        if(!reader.get(magic) || magic != kCheckpointMagic || !reader.get(version) || version != kCheckpointVersion ||
+              !reader.get(checkpoint_feed) || checkpoint_feed != feed)
+        {
+          return false;
+        }
+
+        if(!reader.get(feed_offset) || !reader.get(num_msgs_) || !reader.get(invalid_stats_) ||
+              !reader.get(last_trade_.first) || !reader.get(last_trade_.second))
+        {
+          return false;
+        }
+
+        return order_book_.load_checkpoint(reader);
+      }
+
+      bool saveCheckpoint(const char* path, uint64_t feed_offset, const FeedIdentity& feed) const
+      {
+        CheckpointWriter writer;
+        saveCheckpoint(writer, feed_offset, feed);
+        return writeCheckpointFile(path, writer);
+      }
+
+      bool loadCheckpoint(const char* path, uint64_t& feed_offset, const FeedIdentity& feed)
+      {
+        std::vector<char> image;
+        if(!readCheckpointFile(path, image))
+        {
+          return false;
+        }
+
+        CheckpointReader reader(image.data(), image.size());
+        return loadCheckpoint(reader, feed_offset, feed);
+      }
+
+      template<typename stream_t>
+      void printCurrentOrderBook(stream_t &os) const
+      {
+        order_book_.print(os);
+        os << "*** Last trade -> " << last_trade_.second 
+                    << " @ " << last_trade_.first << "\n";
+      }
+    
+      void printInvadStat(std::ostream& os) const
+      {
+        os << "Corrupted Msg : " << invalid_stats_.num_corrupted_msg
+           << " Duplicate Order Id : " << invalid_stats_.num_duplicate_order
+           << " Unknown Trade : " << invalid_stats_.num_unknown_trade
+           << " Unknown order modify or cancel : " << invalid_stats_.num_unknown_mod
+           << " Top of book crossed : " << invalid_stats_.num_crossed
+           << " Invalid Negative Msg Field : " << invalid_stats_.num_invalid_neg << std::endl;
+      }
+
+    private:
+
+      //dispatch the raw message to each handling method
+      void dispatchMessage(const char* line, size_t size)
+      {
+        if(UNLIKELY(size <= 2 || line[1] != ','))
+        {
+          //invalid short message, should not happen
+          ++ invalid_stats_.num_corrupted_msg;
+          TRACE_INVALID(corrupted_msg, 0);
+          return;
+        }
+      
+        MessageType msg_type = static_cast<MessageType>(line[0]);
+        const char* msg = line + 2;
+        switch(msg_type)
+        {
+          case MessageType::add:
+          {
+            LATENCY_BEGIN(msg_start);
+            processOrderAdd(msg);
+            LATENCY_END(msg_start, LatencyProbe::msg_add);
+            break;
+          }
+          case MessageType::mod:
+          {
+            LATENCY_BEGIN(msg_start);
+            processOrderMod(msg);
+            LATENCY_END(msg_start, LatencyProbe::msg_mod);
+            break;
+          }
+          case MessageType::del:
+          {
+            LATENCY_BEGIN(msg_start);
+            processOrderDel(msg);
+            LATENCY_END(msg_start, LatencyProbe::msg_del);
+            break;
+          }
+          case MessageType::trade:
+          {
+            LATENCY_BEGIN(msg_start);
+            processTrade(msg);
+            LATENCY_END(msg_start, LatencyProbe::msg_trade);
+            break;
+          }
+          default:
+          {
+            //unknown message type, should not happen;
+            std::cout << "Error, unknown message type, skip..." << std::endl;
+            ++ invalid_stats_.num_corrupted_msg;
+            TRACE_INVALID(corrupted_msg, 0);
+          }
+        }
+
+      }
+
+      //same checks and counters as the text path, without the parsing
+      void dispatchMessage(const BinaryMessage& msg, const MessagePrefetch* prefetch)
+      {
+        switch(static_cast<MessageType>(msg.type))
+        {
+          case MessageType::add:
+          {
+            LATENCY_BEGIN(msg_start);
+            if(LIKELY(validateOrderMsg(msg)))
+            {
+              //the index entry is inserted here, the lookup stage only warmed its bucket
+              order_book_.add_order(msg.id, ToSide(msg.side), msg.qty, msg.price, prefetch ? prefetch->level : nullptr);
+            }
+            LATENCY_END(msg_start, LatencyProbe::msg_add);
+            break;
+          }
+          case MessageType::mod:
+          {
+            LATENCY_BEGIN(msg_start);
+            if(LIKELY(validateOrderMsg(msg)))
+            {
+              if(prefetch)
+              {
+                order_book_.amend_order(prefetch->order_iter, msg.id, ToSide(msg.side), msg.qty, msg.price,
+                                        prefetch->level);
+              }
+              else
+              {
+                order_book_.amend_order(msg.id, ToSide(msg.side), msg.qty, msg.price);
+              }
+            }
+            LATENCY_END(msg_start, LatencyProbe::msg_mod);
+            break;
+          }
+          case MessageType::del:
+          {
+            LATENCY_BEGIN(msg_start);
+            if(LIKELY(validateOrderMsg(msg)))
+            {
+              if(prefetch)
+              {
+                order_book_.cancel_order(prefetch->order_iter, msg.id);
+              }
+              else
+              {
+                order_book_.cancel_order(msg.id);
+              }
+            }
+            LATENCY_END(msg_start, LatencyProbe::msg_del);
+            break;
+          }
+          case MessageType::trade:
+          {
+            LATENCY_BEGIN(msg_start);
+            if(UNLIKELY(msg.qty == std::numeric_limits<uint32_t>::max() || !std::isfinite(msg.price)))
+            {
+              ++ invalid_stats_.num_corrupted_msg;
+              TRACE_INVALID(corrupted_msg, 0);
+            }
+            else if(UNLIKELY(msg.price <= 0))
+            {
+              ++ invalid_stats_.num_invalid_neg;
+              TRACE_INVALID(invalid_neg, 0);
+            }
+            else
+            {
+              applyTrade(msg.qty, msg.price);
+            }
+            LATENCY_END(msg_start, LatencyProbe::msg_trade);
+            break;
+          }
+          default:
+          {
+            ++ invalid_stats_.num_corrupted_msg;
+            TRACE_INVALID(corrupted_msg, 0);
+          }
+        }
+      }
+
+      void publishSnapshot()
+      {
+        auto fill = [this](ShmBookSnapshot& snapshot)
+        {
+          snapshot.msg_seq = num_msgs_;
+          for(auto side : {SideType::bid, SideType::ask})
+          {
+            auto levels = snapshot.levels[static_cast<int>(side)];
+            snapshot.num_levels[static_cast<int>(side)] = order_book_.visit_levels(side, kShmBookDepth, 
+                  [&levels](price_t price, uint64_t qty)
+                  {
+                    levels->price = price;
+                    levels->qty = qty;
+                    ++levels;
+                  });
+          }
+          snapshot.last_trade_price = last_trade_.first;
+          snapshot.last_trade_qty = last_trade_.second;
+          snapshot.invalid_stats = invalid_stats_;
+        };
+
+        if(shm_writer_)
+        {
+          shm_writer_->publish(shm_book_, fill);
+        }
+        if(snapshot_buffer_)
+        {
+          snapshot_buffer_->publish(fill);
+        }
+      }
+    
+      bool processOrderMsg(const char* msg, order_id_t& id, SideType& side, qty_t& qty, price_t& price)
+      {
+        id = parseUnsignedField(msg, ',');
+        if(UNLIKELY(id == std::numeric_limits<uint32_t>::max() || id == 0))
+        {
+          ++ invalid_stats_.num_corrupted_msg;
+          TRACE_INVALID(corrupted_msg, id);
+          return false;
+        }
+
+        ++msg;
+        auto side_char = parseChar(msg, ',');
+        if(!side_char)
+        {
+          ++ invalid_stats_.num_corrupted_msg;
+          TRACE_INVALID(corrupted_msg, id);
+          return false;
+        }
+
+        side  = ToSide(side_char);
+        if(UNLIKELY(side == SideType::unknown))
+        {
+          ++ invalid_stats_.num_corrupted_msg;
+          TRACE_INVALID(corrupted_msg, id);
+          return false;
+        }
+
+        ++msg;
+        qty = parseUnsignedField(msg, ','); 
+        if(UNLIKELY(qty == std::numeric_limits<uint32_t>::max() || qty == 0))
+        {
+          ++ invalid_stats_.num_corrupted_msg;
+          TRACE_INVALID(corrupted_msg, id);
+          return false;
+        }
+
+        ++msg;
+        price = parseDouble(msg, '\0');
+        if(UNLIKELY(price == std::numeric_limits<double>::infinity()))
+        {
+          ++ invalid_stats_.num_corrupted_msg;
+          TRACE_INVALID(corrupted_msg, id);
+          return false;
+        }
+
+        if(UNLIKELY(price <= 0))
+        {
+          ++ invalid_stats_.num_invalid_neg;
+          TRACE_INVALID(invalid_neg, id);
+          return false;
+        }
+
+        return true;
+      }
+
+      bool validateOrderMsg(const BinaryMessage& msg)
+      {
+        if(UNLIKELY(msg.id == std::numeric_limits<uint32_t>::max() || msg.id == 0 ||
+                      ToSide(msg.side) == SideType::unknown ||
+                      msg.qty == std::numeric_limits<uint32_t>::max() || msg.qty == 0 ||
+                      !std::isfinite(msg.price)))
+        {
+          ++ invalid_stats_.num_corrupted_msg;
+          TRACE_INVALID(corrupted_msg, msg.id);
+          return false;
+        }
+
+        if(UNLIKELY(msg.price <= 0))
+        {
+          ++ invalid_stats_.num_invalid_neg;
+          TRACE_INVALID(invalid_neg, msg.id);
+          return false;
+        }
+
+        return true;
+      }
+
+      void processOrderAdd(const char* msg)
+      {
+        order_id_t order_id = 0;
+        SideType side = SideType::unknown;
+        qty_t qty = 0;
+        price_t price = 0;
+
+        LATENCY_BEGIN(parse_start);
+        bool valid = processOrderMsg(msg, order_id, side, qty, price);
+        LATENCY_END(parse_start, LatencyProbe::parse);
+
+        if(LIKELY(valid))
+        {
+          //std::cout << "processOrderAdd: " << order_id << " " << ToStr(side) << " " << qty << " @ " << price << std::endl;
+          order_book_.add_order(order_id, side, qty, price);   
+        }
+
+      }
+
+      void processOrderMod(const char* msg)
+      { 
+        order_id_t order_id = 0;
+        SideType side = SideType::unknown;
+        qty_t qty = 0;
+        price_t price = 0;
+
+        LATENCY_BEGIN(parse_start);
+        bool valid = processOrderMsg(msg, order_id, side, qty, price);
+        LATENCY_END(parse_start, LatencyProbe::parse);
+
+        if(LIKELY(valid))
+        {
+          //std::cout << "processOrderMod: " << order_id << " " << ToStr(side) << " " << qty << " @ " << price << std::endl;
+          order_book_.amend_order(order_id, side, qty, price);   
+        }
+      }
+    
+      void processOrderDel(const char* msg)
+      {
+        order_id_t order_id = 0;
+        SideType side = SideType::unknown;
+        qty_t qty = 0;
+        price_t price = 0;
+
+        LATENCY_BEGIN(parse_start);
+        bool valid = processOrderMsg(msg, order_id, side, qty, price);
+        LATENCY_END(parse_start, LatencyProbe::parse);
+
+        if(LIKELY(valid))
+        {
+          //std::cout << "processOrderCancel: " << order_id << " " << ToStr(side) << " " << qty << " @ " << price << std::endl;
+          order_book_.cancel_order(order_id);   
+        }
+      }
+
+      void processTrade(const char* msg)
+      {
+        qty_t qty = 0;
+        price_t price = 0;
+
+        LATENCY_BEGIN(parse_start);
+        bool valid = processTradeMsg(msg, qty, price);
+        LATENCY_END(parse_start, LatencyProbe::parse);
+
+        if(LIKELY(valid))
+        {
+          //std::cout << "processTrade: " << qty << " @ " << price << std::endl;
+          applyTrade(qty, price);
+        }
+      }
+
+      bool processTradeMsg(const char* msg, qty_t& qty, price_t& price)
+      {
+        qty = parseUnsignedField(msg, ','); 
+        if(UNLIKELY(qty == std::numeric_limits<uint32_t>::max()))
+        {
+          ++ invalid_stats_.num_corrupted_msg;
+          TRACE_INVALID(corrupted_msg, 0);
+          return false;
+        }
+
+        ++msg;
+
+        price = parseDouble(msg, '\0');
+        if(UNLIKELY(price == std::numeric_limits<double>::infinity()))
+        {
+          ++ invalid_stats_.num_corrupted_msg;
+          TRACE_INVALID(corrupted_msg, 0);
+          return false;
+        }
+
+        if(UNLIKELY(price <= 0))
+        {
+          ++ invalid_stats_.num_invalid_neg;
+          TRACE_INVALID(invalid_neg, 0);
+          return false;
+        }
+        return true;
+      }
+
+      void applyTrade(qty_t qty, price_t price)
+      {
+        if(price == last_trade_.first)
+        {
+          last_trade_.second += qty;
+        }
+        else
+        {
+          last_trade_.first = price;
+          last_trade_.second = qty;
+        }
+      }
+
+    private:
+      InvalidStats invalid_stats_;
+      OrderBook<boost::object_pool<Order, PoolMemory<>>, 
+          boost::object_pool<PriceLevel, PoolMemory<>>> order_book_;
+      std::pair<price_t, qty_t> last_trade_= {0,0};
+      uint64_t num_msgs_ = 0;
+
+      ShmBookWriter* shm_writer_ = nullptr;
+      uint32_t shm_book_ = 0;
+      BookSnapshotBuffer* snapshot_buffer_ = nullptr;
+  };
+}
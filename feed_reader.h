@@ -0,0 +1,635 @@
+#pragma once
+
+#include "utils.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/iostreams/device/file_descriptor.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filter/zstd.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+//lz4 frames need liblz4, detected by cmake which then defines ORDER_BOOK_HAVE_LZ4
+#ifdef ORDER_BOOK_HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+//zstd frames are decoded with libzstd when cmake finds its header and defines ORDER_BOOK_HAVE_ZSTD, which
+//detects a capture cut off inside a frame. the boost iostreams fallback reads such a capture as a clean end
+#ifdef ORDER_BOOK_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace order_book
+{
+  enum class FeedCompression : uint8_t
+  {
+    none,
+    gzip,
+    zstd,
+    lz4
+  };
+
+  inline const char* ToStr(FeedCompression compression)
+  {
+    switch(compression)
+    {
+      case FeedCompression::none:
+        return "none";
+      case FeedCompression::gzip:
+        return "gzip";
+      case FeedCompression::zstd:
+        return "zstd";
+      case FeedCompression::lz4:
+        return "lz4";
+      default:
+        return "unknown";
+    }
+  }
+
+  //compression of a file from its first bytes, anything without a known frame magic is read as is
+  inline FeedCompression detectCompression(const unsigned char* magic, size_t size)
+  {
+    if(size >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+    {
+      return FeedCompression::gzip;
+    }
+
+    if(size >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+    {
+      return FeedCompression::zstd;
+    }
+
+    if(size >= 4 && magic[0] == 0x04 && magic[1] == 0x22 && magic[2] == 0x4d && magic[3] == 0x18)
+    {
+      return FeedCompression::lz4;
+    }
+
+    return FeedCompression::none;
+  }
+
+#ifndef ORDER_BOOK_HAVE_ZSTD
+  //whether the zstd file ends with a complete frame, walked from the frame and block headers without decoding
+  //(rfc 8878). skippable frames are stepped over
+  inline bool zstdFramesComplete(int fd)
+  {
+    struct stat st;
+    if(::fstat(fd, &st) != 0)
+    {
+      return false;
+    }
+
+    auto readAt = [fd](uint64_t pos, unsigned char* out, size_t size)
+    {
+      return ::pread(fd, out, size, pos) == static_cast<ssize_t>(size);
+    };
+    auto le = [](const unsigned char* bytes, size_t size)
+    {
+      uint64_t value = 0;
+      for(size_t i = size; i > 0; --i)
+      {
+        value = (value << 8) | bytes[i - 1];
+      }
+      return value;
+    };
+
+    const uint64_t end = st.st_size;
+    uint64_t pos = 0;
+    unsigned char header[8];
+    while(pos < end)
+    {
+      if(!readAt(pos, header, 4))
+      {
+        return false;
+      }
+
+      auto magic = le(header, 4);
+      if((magic & 0xfffffff0) == 0x184d2a50)
+      {
+        if(!readAt(pos + 4, header, 4))
+        {
+          return false;
+        }
+        pos += 8 + le(header, 4);
+        continue;
+      }
+
+      if(magic != 0xfd2fb528 || !readAt(pos + 4, header, 1))
+      {
+        return false;
+      }
+
+      const unsigned char descriptor = header[0];
+      const bool single_segment = descriptor & 0x20;
+      const bool checksum = descriptor & 0x04;
+      static const uint64_t dictionary_sizes[] = {0, 1, 2, 4};
+      static const uint64_t content_sizes[] = {0, 2, 4, 8};
+      uint64_t content_size = content_sizes[descriptor >> 6];
+      if((descriptor >> 6) == 0 && single_segment)
+      {
+        content_size = 1;
+      }
+      pos += 5 + (single_segment ? 0 : 1) + dictionary_sizes[descriptor & 3] + content_size;
+
+      bool last = false;
+      while(!last)
+      {
+        if(!readAt(pos, header, 3))
+        {
+          return false;
+        }
+
+        auto block = le(header, 3);
+        last = block & 1;
+        auto type = (block >> 1) & 3;
+        if(type == 3)
+        {
+          return false;
+        }
+        pos += 3 + (type == 1 ? 1 : block >> 3);
+      }
+      pos += checksum ? 4 : 0;
+    }
+    return pos == end;
+  }
+#endif
+
+  //reads a feed file on a background thread, decompressing it on the fly when it is compressed, into a ring of
+  //reusable buffers that next_line frames in place. with the default two buffers the thread fills one while
+  //the messages of the other are processed
+  class FeedReader
+  {
+    public:
+
+      static constexpr size_t kDefaultBufferSize = 1 << 22;
+
+      explicit FeedReader(size_t buffer_size = kDefaultBufferSize, size_t num_buffers = 2) :
+                  buffer_size_(buffer_size), buffers_(num_buffers)
+      {
+        assert(buffer_size > 0 && num_buffers > 0);
+        for(auto& buffer : buffers_)
+        {
+          //one spare byte so the last line of the feed can be terminated in place
+          buffer.data.reset(new char[buffer_size + 1]);
+        }
+      }
+
+      FeedReader(const FeedReader&) = delete;
+      FeedReader& operator=(const FeedReader&) = delete;
+
+      ~FeedReader()
+      {
+        close();
+      }
+
+      //detect the compression and start the reader thread, offset is in uncompressed bytes: plain files seek
+      //to it, compressed ones decompress and drop everything before it
+      bool open(const char* path, uint64_t offset = 0)
+      {
+        assert(fd_ < 0);
+        fd_ = ::open(path, O_RDONLY);
+        if(fd_ < 0)
+        {
+          return false;
+        }
+
+        unsigned char magic[4];
+        ssize_t size = ::pread(fd_, magic, sizeof(magic), 0);
+        compression_ = detectCompression(magic, size > 0 ? size : 0);
+#ifndef ORDER_BOOK_HAVE_LZ4
+        if(compression_ == FeedCompression::lz4)
+        {
+          close();
+          return false;
+        }
+#endif
+
+        //a plain file can be checked up front, a compressed one fails once it ends before the offset
+        struct stat st;
+        if(compression_ == FeedCompression::none && offset &&
+              (::fstat(fd_, &st) != 0 || offset > static_cast<uint64_t>(st.st_size) || ::lseek(fd_, offset, SEEK_SET) < 0))
+        {
+          close();
+          return false;
+        }
+
+        skip_ = compression_ == FeedCompression::none ? 0 : offset;
+        offset_ = offset;
+        thread_ = std::thread([this]() { run(); });
+        return true;
+      }
+
+      FeedCompression compression() const
+      {
+        return compression_;
+      }
+
+      //uncompressed offset right after the last line returned, its newline included only when there was one
+      uint64_t offset() const
+      {
+        return offset_;
+      }
+
+      //next line without its newline and NUL terminated, valid until the next call. false at the end of the
+      //feed or once the reader thread failed, which ok() tells apart
+      bool next_line(const char*& line, size_t& size)
+      {
+        if(carry_returned_)
+        {
+          carry_.clear();
+          carry_returned_ = false;
+        }
+
+        while(true)
+        {
+          if(cur_ != end_)
+          {
+            char* begin = cur_;
+            char* newline = static_cast<char*>(std::memchr(cur_, '\n', end_ - cur_));
+            if(LIKELY(newline))
+            {
+              *newline = '\0';
+              cur_ = newline + 1;
+              offset_ += cur_ - begin;
+              if(LIKELY(carry_.empty()))
+              {
+                line = begin;
+                size = newline - begin;
+                return true;
+              }
+
+              //the line started in the previous buffer
+              carry_.append(begin, newline - begin);
+              return returnCarry(line, size);
+            }
+
+            carry_.append(begin, end_ - begin);
+            offset_ += end_ - begin;
+            cur_ = end_;
+          }
+
+          if(!nextBuffer())
+          {
+            //last line without a newline, unless the feed was cut off in the middle of it
+            return !carry_.empty() && ok() && returnCarry(line, size);
+          }
+        }
+      }
+
+      bool ok() const
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return !failed_;
+      }
+
+      void close()
+      {
+        if(thread_.joinable())
+        {
+          {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+          }
+          cond_.notify_all();
+          thread_.join();
+        }
+
+        if(fd_ >= 0)
+        {
+          ::close(fd_);
+          fd_ = -1;
+        }
+      }
+
+    private:
+
+      struct Buffer
+      {
+        std::unique_ptr<char[]> data;
+        size_t size = 0;
+      };
+
+      bool returnCarry(const char*& line, size_t& size)
+      {
+        line = carry_.c_str();
+        size = carry_.size();
+        carry_returned_ = true;
+        return true;
+      }
+
+      //hand the current buffer back to the reader thread and wait for the next one
+      bool nextBuffer()
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if(holding_)
+        {
+          ++consumed_;
+          holding_ = false;
+          cond_.notify_all();
+        }
+
+        cond_.wait(lock, [this]() { return filled_ != consumed_ || done_; });
+        if(filled_ == consumed_)
+        {
+          return false;
+        }
+
+        auto& buffer = buffers_[consumed_ % buffers_.size()];
+        holding_ = true;
+        cur_ = buffer.data.get();
+        end_ = cur_ + buffer.size;
+        return true;
+      }
+
+      //reader thread, read(out, capacity) returns the number of bytes produced, 0 at the end and -1 on error
+      template<typename read_t>
+      void pump(read_t&& read)
+      {
+        bool failed = false;
+        while(true)
+        {
+          {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this]() { return filled_ - consumed_ < buffers_.size() || stop_; });
+            if(stop_)
+            {
+              break;
+            }
+          }
+
+          auto& buffer = buffers_[filled_ % buffers_.size()];
+          auto size = read(buffer.data.get(), buffer_size_);
+          if(size <= 0)
+          {
+            //a compressed feed shorter than the requested offset
+            failed = size < 0 || skip_ > 0;
+            break;
+          }
+
+          //drop what precedes the requested offset
+          size_t skipped = std::min<uint64_t>(skip_, size);
+          skip_ -= skipped;
+          if(skipped)
+          {
+            std::memmove(buffer.data.get(), buffer.data.get() + skipped, size - skipped);
+            size -= skipped;
+            if(size == 0)
+            {
+              continue;
+            }
+          }
+
+          std::lock_guard<std::mutex> lock(mutex_);
+          buffer.size = size;
+          ++filled_;
+          cond_.notify_all();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        failed_ = failed;
+        done_ = true;
+        cond_.notify_all();
+      }
+
+      //fill a whole buffer from the stream, the decompressors produce a few kB per call. an error thrown by a
+      //decompressor loses the count of the read it happened in, so the buffer is filled in small reads and what
+      //was decoded before the error is handed over first, the next call reports the error
+      static ssize_t readStream(std::istream& in, char* out, size_t capacity)
+      {
+        constexpr size_t kChunkSize = 1 << 12;
+        size_t size = 0;
+        while(size < capacity && in)
+        {
+          in.read(out + size, std::min(kChunkSize, capacity - size));
+          size += in.gcount();
+        }
+
+        if(in.bad() && size == 0)
+        {
+          return -1;
+        }
+        return size;
+      }
+
+      //read of the raw file, 0 at its end and -1 on error
+      ssize_t readFd(char* out, size_t capacity)
+      {
+        while(true)
+        {
+          ssize_t ret = ::read(fd_, out, capacity);
+          if(ret >= 0 || errno != EINTR)
+          {
+            return ret;
+          }
+        }
+      }
+
+      void run()
+      {
+        namespace io = boost::iostreams;
+        switch(compression_)
+        {
+          case FeedCompression::none:
+          {
+            pump([this](char* out, size_t capacity) -> ssize_t
+            {
+              size_t size = 0;
+              while(size < capacity)
+              {
+                ssize_t ret = ::read(fd_, out + size, capacity - size);
+                if(ret < 0 && errno == EINTR)
+                {
+                  continue;
+                }
+                if(ret < 0)
+                {
+                  return -1;
+                }
+                if(ret == 0)
+                {
+                  break;
+                }
+                size += ret;
+              }
+              return size;
+            });
+            break;
+          }
+#ifdef ORDER_BOOK_HAVE_ZSTD
+          case FeedCompression::zstd:
+          {
+            ZSTD_DStream* context = ZSTD_createDStream();
+            if(!context)
+            {
+              pump([](char*, size_t) -> ssize_t { return -1; });
+              break;
+            }
+
+            std::vector<char> input_data(ZSTD_DStreamInSize());
+            ZSTD_inBuffer input = {input_data.data(), 0, 0};
+            //0 once a frame is fully decoded and flushed
+            size_t hint = 0;
+            bool output_full = false;
+            bool failed = false;
+            pump([&](char* out, size_t capacity) -> ssize_t
+            {
+              ZSTD_outBuffer output = {out, capacity, 0};
+              while(!failed && output.pos < output.size)
+              {
+                //a full output may have left decoded data in the context, drain it before reading more
+                if(input.pos == input.size && !output_full)
+                {
+                  ssize_t ret = readFd(input_data.data(), input_data.size());
+                  if(ret <= 0)
+                  {
+                    //cut off inside a frame
+                    failed = ret < 0 || hint != 0;
+                    break;
+                  }
+                  input.size = ret;
+                  input.pos = 0;
+                }
+
+                hint = ZSTD_decompressStream(context, &output, &input);
+                if(ZSTD_isError(hint))
+                {
+                  failed = true;
+                  break;
+                }
+                output_full = output.pos == output.size;
+              }
+              return failed && output.pos == 0 ? -1 : output.pos;
+            });
+            ZSTD_freeDStream(context);
+            break;
+          }
+#endif
+          case FeedCompression::gzip:
+#ifndef ORDER_BOOK_HAVE_ZSTD
+          case FeedCompression::zstd:
+#endif
+          {
+            io::filtering_istream in;
+            if(compression_ == FeedCompression::gzip)
+            {
+              in.push(io::gzip_decompressor());
+            }
+            else
+            {
+              in.push(io::zstd_decompressor());
+            }
+            in.push(io::file_descriptor_source(fd_, io::never_close_handle));
+            pump([&](char* out, size_t capacity) -> ssize_t
+            {
+              auto size = readStream(in, out, capacity);
+#ifndef ORDER_BOOK_HAVE_ZSTD
+              //boost ends a zstd capture cut off inside a frame as if it were complete
+              if(size == 0 && compression_ == FeedCompression::zstd && !zstdFramesComplete(fd_))
+              {
+                return -1;
+              }
+#endif
+              return size;
+            });
+            break;
+          }
+#ifdef ORDER_BOOK_HAVE_LZ4
+          case FeedCompression::lz4:
+          {
+            LZ4F_dctx* context = nullptr;
+            if(LZ4F_isError(LZ4F_createDecompressionContext(&context, LZ4F_VERSION)))
+            {
+              pump([](char*, size_t) -> ssize_t { return -1; });
+              break;
+            }
+
+            std::vector<char> input(1 << 20);
+            size_t input_pos = 0;
+            size_t input_size = 0;
+            //0 once a frame is fully decoded and flushed
+            size_t hint = 0;
+            bool output_full = false;
+            bool failed = false;
+            pump([&](char* out, size_t capacity) -> ssize_t
+            {
+              size_t size = 0;
+              while(!failed && size < capacity)
+              {
+                //a full output may have left decoded data in the context, drain it before reading more
+                if(input_pos == input_size && !output_full)
+                {
+                  ssize_t ret = readFd(input.data(), input.size());
+                  if(ret <= 0)
+                  {
+                    //cut off inside a frame
+                    failed = ret < 0 || hint != 0;
+                    break;
+                  }
+                  input_pos = 0;
+                  input_size = ret;
+                }
+
+                size_t out_size = capacity - size;
+                size_t in_size = input_size - input_pos;
+                hint = LZ4F_decompress(context, out + size, &out_size, input.data() + input_pos, &in_size, nullptr);
+                if(LZ4F_isError(hint))
+                {
+                  failed = true;
+                  break;
+                }
+                input_pos += in_size;
+                size += out_size;
+                output_full = size == capacity;
+              }
+              return failed && size == 0 ? -1 : size;
+            });
+            LZ4F_freeDecompressionContext(context);
+            break;
+          }
+#endif
+          default:
+            pump([](char*, size_t) -> ssize_t { return -1; });
+        }
+      }
+
+    private:
+
+      const size_t buffer_size_;
+      std::vector<Buffer> buffers_;
+      int fd_ = -1;
+      FeedCompression compression_ = FeedCompression::none;
+      uint64_t skip_ = 0;
+      std::thread thread_;
+      //processing thread
+      uint64_t offset_ = 0;
+
+      mutable std::mutex mutex_;
+      std::condition_variable cond_;
+      //buffers produced and released since open, the consumer owns buffer consumed_ while holding_
+      uint64_t filled_ = 0;
+      uint64_t consumed_ = 0;
+      bool holding_ = false;
+      bool done_ = false;
+      bool failed_ = false;
+      bool stop_ = false;
+
+      //processing thread
+      char* cur_ = nullptr;
+      char* end_ = nullptr;
+      std::string carry_;
+      bool carry_returned_ = false;
+  };
+}
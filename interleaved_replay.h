@@ -0,0 +1,126 @@
+#pragma once
+
+//coroutines need C++20, build with cmake -DORDER_BOOK_COROUTINES=ON which switches the standard and defines
+//ORDER_BOOK_COROUTINES. the rest of the tree stays C++11
+#ifndef ORDER_BOOK_COROUTINES
+#error "interleaved_replay.h needs -DORDER_BOOK_COROUTINES=ON"
+#endif
+
+#include "feed_handler.h"
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <vector>
+
+namespace order_book
+{
+  //one feed replayed as a coroutine, suspended after each prefetch stage of every message so a scheduler can
+  //run the other feeds while the prefetched nodes arrive
+  class ReplayTask
+  {
+    public:
+
+      struct promise_type
+      {
+        ReplayTask get_return_object()
+        {
+          return ReplayTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+          return {};
+        }
+
+        std::suspend_always final_suspend() noexcept
+        {
+          return {};
+        }
+
+        void return_void()
+        {
+        }
+
+        void unhandled_exception()
+        {
+          std::terminate();
+        }
+      };
+
+      ReplayTask(ReplayTask&& other) noexcept : handle_(std::exchange(other.handle_, nullptr))
+      {
+      }
+
+      ReplayTask(const ReplayTask&) = delete;
+      ReplayTask& operator=(const ReplayTask&) = delete;
+
+      ~ReplayTask()
+      {
+        if(handle_)
+        {
+          handle_.destroy();
+        }
+      }
+
+      bool done() const
+      {
+        return handle_.done();
+      }
+
+      //run up to the next suspension
+      void resume()
+      {
+        handle_.resume();
+      }
+
+    private:
+
+      explicit ReplayTask(std::coroutine_handle<promise_type> handle) : handle_(handle)
+      {
+      }
+
+      std::coroutine_handle<promise_type> handle_;
+  };
+
+  //apply [begin, end) to the feed, each message in three steps: index and level lookups, neighbour prefetches
+  //then the book update reusing the lookups. the feed and the messages must outlive the task
+  inline ReplayTask replayInterleaved(FeedHandler& feed, const BinaryMessage* begin, const BinaryMessage* end)
+  {
+    FeedHandler::MessagePrefetch prefetch;
+    for(auto msg = begin; msg != end; ++msg)
+    {
+      feed.prefetchLookup(*msg, prefetch);
+      co_await std::suspend_always();
+      feed.prefetchLinks(prefetch);
+      co_await std::suspend_always();
+      feed.processMessage(*msg, &prefetch);
+    }
+  }
+
+  //resume the tasks round robin until all of them are done, with K feeds each prefetch has K - 1 steps of the
+  //other feeds to arrive
+  inline void runInterleaved(std::vector<ReplayTask>& tasks)
+  {
+    std::vector<ReplayTask*> running;
+    for(auto& task : tasks)
+    {
+      running.push_back(&task);
+    }
+
+    while(!running.empty())
+    {
+      for(size_t i = 0; i < running.size();)
+      {
+        running[i]->resume();
+        if(UNLIKELY(running[i]->done()))
+        {
+          running[i] = running.back();
+          running.pop_back();
+          continue;
+        }
+        ++i;
+      }
+    }
+  }
+}
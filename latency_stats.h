@@ -0,0 +1,255 @@
+#pragma once
+
+#include "utils.h"
+
+#include <chrono>
+#include <cstdint>
+#include <csignal>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//per message type and per phase cycle histograms, compiled in with -DORDER_BOOK_LATENCY_STATS
+//(cmake -DORDER_BOOK_LATENCY_STATS=ON). without it every probe macro expands to nothing
+#ifdef ORDER_BOOK_LATENCY_STATS
+#define LATENCY_BEGIN(name) const uint64_t name = ::order_book::readTsc()
+#define LATENCY_END(name, probe) ::order_book::LatencyRegistry<>::record(probe, ::order_book::readTsc() - name)
+#else
+#define LATENCY_BEGIN(name)
+#define LATENCY_END(name, probe)
+#endif
+
+namespace order_book
+{
+  inline uint64_t readTsc()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+  //tsc cycles per nanosecond, measured once against the steady clock
+  inline double tscCyclesPerNs()
+  {
+    static const double ratio = []()
+    {
+      auto start_ns = std::chrono::steady_clock::now();
+      auto start = readTsc();
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      auto end = readTsc();
+      auto elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - start_ns).count();
+      return elapsed_ns > 0 ? static_cast<double>(end - start) / elapsed_ns : 1.0;
+    }();
+    return ratio;
+  }
+
+  enum class LatencyProbe : uint8_t
+  {
+    msg_add,
+    msg_mod,
+    msg_del,
+    msg_trade,
+    parse,
+    index_lookup,
+    level_update,
+    cardinality
+  };
+
+  inline const char* ToStr(LatencyProbe probe)
+  {
+    switch(probe)
+    {
+      case LatencyProbe::msg_add:
+        return "add";
+      case LatencyProbe::msg_mod:
+        return "mod";
+      case LatencyProbe::msg_del:
+        return "del";
+      case LatencyProbe::msg_trade:
+        return "trade";
+      case LatencyProbe::parse:
+        return "parse";
+      case LatencyProbe::index_lookup:
+        return "index lookup";
+      case LatencyProbe::level_update:
+        return "level update";
+      default:
+        return "unknown";
+    }
+  }
+
+  //log linear histogram in fixed memory: values below 16 are exact, above that every power of two
+  //is split into 16 linear sub buckets, so a bucket is within 6.25% of the values it holds
+  class LatencyHistogram
+  {
+    public:
+
+      static constexpr int kSubBucketBits = 4;
+      static constexpr int kSubBuckets = 1 << kSubBucketBits;
+      static constexpr int kNumBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+      void record(uint64_t value)
+      {
+        ++counts_[bucket(value)];
+        ++count_;
+        if(UNLIKELY(value > max_))
+        {
+          max_ = value;
+        }
+      }
+
+      uint64_t count() const
+      {
+        return count_;
+      }
+
+      uint64_t max() const
+      {
+        return max_;
+      }
+
+      //upper bound of the bucket holding the given quantile (0..1), capped at the max recorded value
+      uint64_t percentile(double quantile) const
+      {
+        if(count_ == 0)
+        {
+          return 0;
+        }
+
+        uint64_t rank = static_cast<uint64_t>(quantile * (count_ - 1)) + 1;
+        uint64_t seen = 0;
+        for(int i = 0; i < kNumBuckets; ++i)
+        {
+          seen += counts_[i];
+          if(seen >= rank)
+          {
+            auto upper = bucketUpperBound(i);
+            return upper < max_ ? upper : max_;
+          }
+        }
+
+        return max_;
+      }
+
+      void reset()
+      {
+        *this = LatencyHistogram();
+      }
+
+      static int bucket(uint64_t value)
+      {
+        if(value < kSubBuckets)
+        {
+          return static_cast<int>(value);
+        }
+
+        int msb = 63 - __builtin_clzll(value);
+        int sub = static_cast<int>(value >> (msb - kSubBucketBits)) & (kSubBuckets - 1);
+        return (msb - kSubBucketBits + 1) * kSubBuckets + sub;
+      }
+
+      static uint64_t bucketUpperBound(int index)
+      {
+        if(index < kSubBuckets)
+        {
+          return index;
+        }
+
+        int msb = index / kSubBuckets + kSubBucketBits - 1;
+        uint64_t sub = index % kSubBuckets;
+        uint64_t lower = (uint64_t(kSubBuckets) + sub) << (msb - kSubBucketBits);
+        return lower + (uint64_t(1) << (msb - kSubBucketBits)) - 1;
+      }
+
+    private:
+
+      uint64_t counts_[kNumBuckets] = {};
+      uint64_t count_ = 0;
+      uint64_t max_ = 0;
+  };
+
+  //process wide histograms, one per probe. recording is not synchronized, probes are meant for the
+  //single feed processing thread. the template only makes the static storage header only
+  template<typename tag_t = void>
+  class LatencyRegistry
+  {
+    public:
+
+      static void record(LatencyProbe probe, uint64_t cycles)
+      {
+        histograms_[static_cast<int>(probe)].record(cycles);
+      }
+
+      static const LatencyHistogram& histogram(LatencyProbe probe)
+      {
+        return histograms_[static_cast<int>(probe)];
+      }
+
+      //one line per probe with samples, p50/p99/p99.9/max in cycles and nanoseconds
+      template<typename stream_t>
+      static void dump(stream_t& os)
+      {
+        const double ratio = tscCyclesPerNs();
+        os << "*** Latency (cycles / ns, " << ratio << " cycles per ns) ***\n";
+        for(int i = 0; i < static_cast<int>(LatencyProbe::cardinality); ++i)
+        {
+          auto& hist = histograms_[i];
+          if(hist.count() == 0)
+          {
+            continue;
+          }
+
+          os << ToStr(static_cast<LatencyProbe>(i)) << " : count " << hist.count();
+          const double quantiles[] = {0.5, 0.99, 0.999};
+          const char* names[] = {" p50 ", " p99 ", " p99.9 "};
+          for(int q = 0; q < 3; ++q)
+          {
+            auto cycles = hist.percentile(quantiles[q]);
+            os << names[q] << cycles << " / " << cycles / ratio;
+          }
+          os << " max " << hist.max() << " / " << hist.max() / ratio << "\n";
+        }
+      }
+
+      //ask for a dump from a signal handler, the processing loop picks it up with dumpIfRequested
+      static void installSignalHandler(int signal = SIGUSR1)
+      {
+        std::signal(signal, [](int) { dump_requested_ = 1; });
+      }
+
+      template<typename stream_t>
+      static void dumpIfRequested(stream_t& os)
+      {
+        if(UNLIKELY(dump_requested_))
+        {
+          dump_requested_ = 0;
+          dump(os);
+        }
+      }
+
+      static void reset()
+      {
+        for(auto& hist : histograms_)
+        {
+          hist.reset();
+        }
+      }
+
+    private:
+
+      static LatencyHistogram histograms_[static_cast<int>(LatencyProbe::cardinality)];
+      static volatile std::sig_atomic_t dump_requested_;
+  };
+
+  template<typename tag_t>
+  LatencyHistogram LatencyRegistry<tag_t>::histograms_[static_cast<int>(LatencyProbe::cardinality)];
+
+  template<typename tag_t>
+  volatile std::sig_atomic_t LatencyRegistry<tag_t>::dump_requested_ = 0;
+}
@@ -0,0 +1,190 @@
+/**
+Generate a deterministic feed message file, in the text format read by FeedHandler or in the binary format
+read by FeedHandler --binary. replaces message_gen.py
+**/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "feed_file_writer.h"
+
+using namespace order_book;
+
+int main(int argc, char **argv)
+{
+  GeneratorConfig config;
+  config.resting_orders = 0;
+  uint64_t num_msgs = 0;
+  bool has_num_msgs = false;
+  const char* output = nullptr;
+  uint32_t num_symbols = 1;
+  bool binary = false;
+  bool bad_args = false;
+  for(int i = 1; i < argc; ++i)
+  {
+    const std::string arg(argv[i]);
+    const bool has_value = i + 1 < argc;
+    if(arg == "--output" && has_value)
+    {
+      output = argv[++i];
+    }
+    else if(arg == "--symbols" && has_value)
+    {
+      num_symbols = std::strtoul(argv[++i], nullptr, 10);
+    }
+    else if(arg == "--binary")
+    {
+      binary = true;
+    }
+    else if(arg == "--seed" && has_value)
+    {
+      config.seed = std::strtoull(argv[++i], nullptr, 10);
+    }
+    else if(arg == "--mix" && has_value)
+    {
+      bad_args |= std::sscanf(argv[++i], "%u,%u,%u,%u", &config.add_weight, &config.mod_weight,
+                              &config.del_weight, &config.trade_weight) != 4;
+      bad_args |= config.add_weight + config.mod_weight + config.del_weight + config.trade_weight == 0;
+    }
+    else if(arg == "--mid" && has_value)
+    {
+      config.mid_price = std::strtod(argv[++i], nullptr);
+    }
+    else if(arg == "--tick" && has_value)
+    {
+      config.tick_size = std::strtod(argv[++i], nullptr);
+    }
+    else if(arg == "--depth" && has_value)
+    {
+      config.depth = std::strtoul(argv[++i], nullptr, 10);
+    }
+    else if(arg == "--dist" && has_value)
+    {
+      const std::string dist(argv[++i]);
+      if(dist == "uniform")
+      {
+        config.price_distribution = PriceDistribution::uniform;
+      }
+      else if(dist == "touch")
+      {
+        config.price_distribution = PriceDistribution::touch;
+      }
+      else if(dist == "zipf")
+      {
+        config.price_distribution = PriceDistribution::zipf;
+      }
+      else
+      {
+        bad_args = true;
+      }
+    }
+    else if(arg == "--touch-p" && has_value)
+    {
+      config.touch_p = std::strtod(argv[++i], nullptr);
+    }
+    else if(arg == "--zipf-s" && has_value)
+    {
+      config.zipf_s = std::strtod(argv[++i], nullptr);
+    }
+    else if(arg == "--max-qty" && has_value)
+    {
+      config.max_qty = std::strtoul(argv[++i], nullptr, 10);
+    }
+    else if(arg == "--resting" && has_value)
+    {
+      config.resting_orders = std::strtoull(argv[++i], nullptr, 10);
+    }
+    else if(arg == "--corrupt" && has_value)
+    {
+      config.corrupt_rate = std::strtod(argv[++i], nullptr);
+    }
+    else if(arg == "--duplicate" && has_value)
+    {
+      config.duplicate_rate = std::strtod(argv[++i], nullptr);
+    }
+    else if(arg == "--unknown-id" && has_value)
+    {
+      config.unknown_id_rate = std::strtod(argv[++i], nullptr);
+    }
+    else if(arg == "--crossed" && has_value)
+    {
+      config.crossed_rate = std::strtod(argv[++i], nullptr);
+    }
+    else if(arg == "--negative" && has_value)
+    {
+      config.negative_rate = std::strtod(argv[++i], nullptr);
+    }
+    else if(arg == "--unknown-trade" && has_value)
+    {
+      config.unknown_trade_rate = std::strtod(argv[++i], nullptr);
+    }
+    else if(!has_num_msgs && arg.compare(0, 2, "--") != 0)
+    {
+      num_msgs = std::strtoull(argv[i], nullptr, 10);
+      has_num_msgs = true;
+    }
+    else
+    {
+      bad_args = true;
+    }
+  }
+
+  const double invalid_rate = config.corrupt_rate + config.duplicate_rate + config.unknown_id_rate +
+                              config.crossed_rate + config.negative_rate + config.unknown_trade_rate;
+  if(bad_args || !has_num_msgs || num_symbols == 0 || (num_symbols > 1 && !output) || config.depth == 0 ||
+        config.max_qty == 0 || config.tick_size <= 0 || config.mid_price <= config.depth * config.tick_size ||
+        invalid_rate > 1)
+  {
+    std::cerr << "Usage: " << argv[0] << " <number of messages> [--output <file>] [--symbols <count>] [--binary]"
+              << " [--seed <seed>] [--resting <orders>]" << std::endl;
+    std::cerr << "       [--mix <add>,<mod>,<del>,<trade>] [--mid <price>] [--tick <size>] [--depth <levels>]"
+              << " [--dist uniform|touch|zipf] [--touch-p <p>] [--zipf-s <s>] [--max-qty <qty>]" << std::endl;
+    std::cerr << "       [--corrupt <rate>] [--duplicate <rate>] [--unknown-id <rate>] [--crossed <rate>]"
+              << " [--negative <rate>] [--unknown-trade <rate>]" << std::endl;
+    std::cerr << "writes to stdout without --output, symbol i of several goes to <file>.<i>, seeded with <seed> + i" << std::endl;
+    return -1;
+  }
+
+  if(num_symbols == 1)
+  {
+    if(!generateFeed(config, num_msgs, output, binary))
+    {
+      std::cerr << "Failed to write " << (output ? output : "stdout") << std::endl;
+      return -1;
+    }
+    return 0;
+  }
+
+  //symbols are independent streams, one thread each
+  std::vector<std::string> paths(num_symbols);
+  std::vector<char> results(num_symbols, 0);
+  std::vector<std::thread> threads;
+  for(uint32_t symbol = 0; symbol < num_symbols; ++symbol)
+  {
+    paths[symbol] = std::string(output) + "." + std::to_string(symbol);
+    GeneratorConfig symbol_config = config;
+    symbol_config.seed = config.seed + symbol;
+    threads.emplace_back([&, symbol, symbol_config]()
+    {
+      results[symbol] = generateFeed(symbol_config, num_msgs, paths[symbol].c_str(), binary);
+    });
+  }
+
+  int ret = 0;
+  for(uint32_t symbol = 0; symbol < num_symbols; ++symbol)
+  {
+    threads[symbol].join();
+    if(!results[symbol])
+    {
+      std::cerr << "Failed to write " << paths[symbol] << std::endl;
+      ret = -1;
+    }
+  }
+
+  return ret;
+}
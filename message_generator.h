@@ -0,0 +1,462 @@
+#pragma once
+
+#include "types.h"
+#include "binary_message.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace order_book
+{
+  //splitmix64, deterministic across platforms and standard libraries for a given seed
+  class Rng
+  {
+    public:
+
+      explicit Rng(uint64_t seed) : state_(seed)
+      {
+      }
+
+      uint64_t next()
+      {
+        uint64_t z = (state_ += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+      }
+
+      //uniform in [0, bound)
+      uint64_t uniform(uint64_t bound)
+      {
+        return static_cast<uint64_t>((static_cast<unsigned __int128>(next()) * bound) >> 64);
+      }
+
+      //uniform in [0, 1)
+      double uniformReal()
+      {
+        return (next() >> 11) * (1.0 / (1ULL << 53));
+      }
+
+    private:
+
+      uint64_t state_;
+  };
+
+  enum class PriceDistribution : uint8_t
+  {
+    //every level of the depth profile equally likely
+    uniform,
+    //geometric from the touch, most activity on the first few levels
+    touch,
+    //zipf over the levels, rank 1 at the touch
+    zipf
+  };
+
+  struct Message
+  {
+    MessageType type = MessageType::unknown;
+    SideType side = SideType::unknown;
+    order_id_t id = 0;
+    qty_t qty = 0;
+    price_t price = 0;
+    //non zero renders a malformed message, the value in [1, kNumCorruptions] picks how it is malformed
+    uint8_t corrupt = 0;
+  };
+
+  constexpr uint8_t kNumCorruptions = 4;
+
+  struct GeneratorConfig
+  {
+    uint64_t seed = 1;
+
+    //relative weights of the message types once the book is filled
+    uint32_t add_weight = 45;
+    uint32_t mod_weight = 10;
+    uint32_t del_weight = 40;
+    uint32_t trade_weight = 5;
+
+    //bids rest at mid - (level + 1) * tick, asks at mid + (level + 1) * tick, level in [0, depth)
+    price_t mid_price = 100;
+    price_t tick_size = 0.5;
+    uint32_t depth = 10;
+    PriceDistribution price_distribution = PriceDistribution::uniform;
+    //success probability of the touch distribution, exponent of the zipf distribution
+    double touch_p = 0.5;
+    double zipf_s = 1.1;
+
+    uint32_t max_qty = 10;
+
+    //number of resting orders added by prefill
+    uint64_t resting_orders = 1000;
+
+    //probability per message of injecting an invalid message, each kind bumps one InvalidStats counter once
+    //corrupted_msg: malformed message
+    double corrupt_rate = 0;
+    //duplicate_order: add reusing the id of a live order
+    double duplicate_rate = 0;
+    //unknown_mod: amend or cancel of an id that never rested
+    double unknown_id_rate = 0;
+    //crossed: add crossing the opposite touch followed by the amend moving it back, the cross is counted on the amend
+    double crossed_rate = 0;
+    //invalid_neg: add with a negative price
+    double negative_rate = 0;
+    //unknown_trade: trade at a price outside the band, the feed handler does not flag these yet
+    double unknown_trade_rate = 0;
+  };
+
+  //deterministic stream of order book messages, live orders are kept in a vector so cancels and amends
+  //pick a resting order in O(1). invalid messages are only drawn when an injection rate is set, so the
+  //valid stream of a seed does not depend on the injection support
+  class MessageGenerator
+  {
+    public:
+
+      explicit MessageGenerator(const GeneratorConfig& config) : config_(config), rng_(config.seed)
+      {
+        assert(config_.depth > 0 && config_.max_qty > 0);
+
+        //cumulative weights of the levels for the skewed distributions
+        double total = 0;
+        level_cdf_.resize(config_.depth);
+        for(uint32_t level = 0; level < config_.depth; ++level)
+        {
+          switch(config_.price_distribution)
+          {
+            case PriceDistribution::touch:
+              total += config_.touch_p * std::pow(1 - config_.touch_p, level);
+              break;
+            case PriceDistribution::zipf:
+              total += 1.0 / std::pow(level + 1, config_.zipf_s);
+              break;
+            default:
+              total += 1;
+          }
+          level_cdf_[level] = total;
+        }
+
+        for(auto& cdf : level_cdf_)
+        {
+          cdf /= total;
+        }
+
+        invalid_rate_ = config_.corrupt_rate + config_.duplicate_rate + config_.unknown_id_rate +
+                        config_.crossed_rate + config_.negative_rate + config_.unknown_trade_rate;
+      }
+
+      //adds building the initial resting book
+      void prefill(std::vector<Message>& out)
+      {
+        out.reserve(out.size() + config_.resting_orders);
+        for(uint64_t i = 0; i < config_.resting_orders; ++i)
+        {
+          out.push_back(makeAdd(randomSide()));
+        }
+      }
+
+      Message next()
+      {
+        if(has_pending_)
+        {
+          has_pending_ = false;
+          return pending_;
+        }
+
+        if(invalid_rate_ > 0 && rng_.uniformReal() < invalid_rate_)
+        {
+          return makeInvalid();
+        }
+
+        uint64_t total = config_.add_weight + config_.mod_weight + config_.del_weight + config_.trade_weight;
+        uint64_t pick = rng_.uniform(total);
+
+        if(pick < config_.add_weight || live_orders_.empty())
+        {
+          return makeAdd(randomSide());
+        }
+        pick -= config_.add_weight;
+
+        if(pick < config_.mod_weight)
+        {
+          return makeAmend();
+        }
+        pick -= config_.mod_weight;
+
+        if(pick < config_.del_weight)
+        {
+          return makeCancel();
+        }
+
+        Message msg;
+        msg.type = MessageType::trade;
+        msg.qty = randomQty();
+        msg.price = levelPrice(randomSide(), randomLevel());
+        return msg;
+      }
+
+      void generate(std::vector<Message>& out, uint64_t count)
+      {
+        out.reserve(out.size() + count);
+        for(uint64_t i = 0; i < count; ++i)
+        {
+          out.push_back(next());
+        }
+      }
+
+      size_t num_live_orders() const
+      {
+        return live_orders_.size();
+      }
+
+      price_t levelPrice(SideType side, uint32_t level) const
+      {
+        price_t offset = (level + 1) * config_.tick_size;
+        return side == SideType::bid ? config_.mid_price - offset : config_.mid_price + offset;
+      }
+
+      //the mix can be changed between calls, the level profile is fixed at construction
+      void setMix(uint32_t add_weight, uint32_t mod_weight, uint32_t del_weight, uint32_t trade_weight)
+      {
+        assert(add_weight + mod_weight + del_weight + trade_weight > 0);
+        config_.add_weight = add_weight;
+        config_.mod_weight = mod_weight;
+        config_.del_weight = del_weight;
+        config_.trade_weight = trade_weight;
+      }
+
+      const GeneratorConfig& config() const
+      {
+        return config_;
+      }
+
+      Rng& rng()
+      {
+        return rng_;
+      }
+
+    protected:
+
+      struct LiveOrder
+      {
+        order_id_t id;
+        SideType side;
+        qty_t qty;
+        price_t price;
+      };
+
+      SideType randomSide()
+      {
+        return rng_.uniform(2) ? SideType::ask : SideType::bid;
+      }
+
+      qty_t randomQty()
+      {
+        return 1 + rng_.uniform(config_.max_qty);
+      }
+
+      uint32_t randomLevel()
+      {
+        if(config_.price_distribution == PriceDistribution::uniform)
+        {
+          return rng_.uniform(config_.depth);
+        }
+
+        auto iter = std::upper_bound(level_cdf_.begin(), level_cdf_.end(), rng_.uniformReal());
+        return std::min<uint32_t>(iter - level_cdf_.begin(), config_.depth - 1);
+      }
+
+      Message makeAdd(SideType side)
+      {
+        Message msg;
+        msg.type = MessageType::add;
+        msg.side = side;
+        msg.id = ++last_order_id_;
+        msg.qty = randomQty();
+        msg.price = levelPrice(side, randomLevel());
+
+        live_orders_.push_back(LiveOrder{msg.id, msg.side, msg.qty, msg.price});
+        ++num_live_[static_cast<int>(side)];
+        return msg;
+      }
+
+      Message makeAmend()
+      {
+        auto& order = live_orders_[rng_.uniform(live_orders_.size())];
+        order.qty = randomQty();
+        //half of the amends move the order to another level on the same side
+        if(rng_.uniform(2))
+        {
+          order.price = levelPrice(order.side, randomLevel());
+        }
+
+        Message msg;
+        msg.type = MessageType::mod;
+        msg.side = order.side;
+        msg.id = order.id;
+        msg.qty = order.qty;
+        msg.price = order.price;
+        return msg;
+      }
+
+      Message makeCancel()
+      {
+        auto index = rng_.uniform(live_orders_.size());
+        auto order = live_orders_[index];
+
+        //swap with the last live order to erase in O(1)
+        live_orders_[index] = live_orders_.back();
+        live_orders_.pop_back();
+        --num_live_[static_cast<int>(order.side)];
+
+        Message msg;
+        msg.type = MessageType::del;
+        msg.side = order.side;
+        msg.id = order.id;
+        msg.qty = order.qty;
+        msg.price = order.price;
+        return msg;
+      }
+
+      static SideType opposite(SideType side)
+      {
+        return side == SideType::bid ? SideType::ask : SideType::bid;
+      }
+
+      //pick the kind of invalid message by its share of the total rate, kinds that need resting orders
+      //the book does not have yet fall back to a valid add
+      Message makeInvalid()
+      {
+        double pick = rng_.uniformReal() * invalid_rate_;
+        auto side = randomSide();
+
+        if((pick -= config_.corrupt_rate) < 0)
+        {
+          Message msg;
+          msg.type = MessageType::add;
+          msg.side = side;
+          msg.id = ++last_order_id_;
+          msg.qty = randomQty();
+          msg.price = levelPrice(side, randomLevel());
+          msg.corrupt = 1 + rng_.uniform(kNumCorruptions);
+          return msg;
+        }
+
+        if((pick -= config_.duplicate_rate) < 0)
+        {
+          if(live_orders_.empty())
+          {
+            return makeAdd(side);
+          }
+
+          auto& order = live_orders_[rng_.uniform(live_orders_.size())];
+          Message msg;
+          msg.type = MessageType::add;
+          msg.side = order.side;
+          msg.id = order.id;
+          msg.qty = randomQty();
+          msg.price = levelPrice(order.side, randomLevel());
+          return msg;
+        }
+
+        if((pick -= config_.unknown_id_rate) < 0)
+        {
+          Message msg;
+          msg.type = rng_.uniform(2) ? MessageType::del : MessageType::mod;
+          msg.side = side;
+          msg.id = ++last_order_id_;
+          msg.qty = randomQty();
+          msg.price = levelPrice(side, randomLevel());
+          return msg;
+        }
+
+        if((pick -= config_.crossed_rate) < 0)
+        {
+          if(!num_live_[static_cast<int>(opposite(side))])
+          {
+            return makeAdd(side);
+          }
+
+          //the order rests at its drawn price once the queued amend moved it back
+          Message msg = makeAdd(side);
+          msg.price = levelPrice(opposite(side), config_.depth - 1);
+
+          pending_ = msg;
+          pending_.type = MessageType::mod;
+          pending_.price = live_orders_.back().price;
+          has_pending_ = true;
+          return msg;
+        }
+
+        if((pick -= config_.negative_rate) < 0)
+        {
+          Message msg;
+          msg.type = MessageType::add;
+          msg.side = side;
+          msg.id = ++last_order_id_;
+          msg.qty = randomQty();
+          msg.price = -levelPrice(side, randomLevel());
+          return msg;
+        }
+
+        Message msg;
+        msg.type = MessageType::trade;
+        msg.qty = randomQty();
+        msg.price = levelPrice(side, config_.depth + randomLevel());
+        return msg;
+      }
+
+    protected:
+
+      GeneratorConfig config_;
+      Rng rng_;
+      std::vector<double> level_cdf_;
+      double invalid_rate_ = 0;
+
+      order_id_t last_order_id_ = 0;
+      std::vector<LiveOrder> live_orders_;
+      size_t num_live_[2] = {0, 0};
+
+      //second half of a two message injection
+      Message pending_;
+      bool has_pending_ = false;
+  };
+
+  //apply a generated message straight to a book, trades and malformed messages do not touch the book
+  template<typename book_t>
+  inline bool applyMessage(book_t& book, const Message& msg)
+  {
+    if(UNLIKELY(msg.corrupt))
+    {
+      return false;
+    }
+
+    switch(msg.type)
+    {
+      case MessageType::add:
+        return book.add_order(msg.id, msg.side, msg.qty, msg.price);
+      case MessageType::mod:
+        return book.amend_order(msg.id, msg.side, msg.qty, msg.price);
+      case MessageType::del:
+        return book.cancel_order(msg.id);
+      default:
+        return false;
+    }
+  }
+
+  //binary feed record of a generated message, malformed messages get the record level corruption of their kind
+  inline BinaryMessage toBinaryMessage(const Message& msg)
+  {
+    BinaryMessage record;
+    std::memset(&record, 0, sizeof(record));
+    record.type = msg.corrupt == 1 ? 'Q' : static_cast<char>(msg.type);
+    record.side = msg.type == MessageType::trade ? '\0' : (msg.corrupt == 2 ? 'Z' : *ToStr(msg.side));
+    record.id = msg.id;
+    record.qty = msg.corrupt == 3 ? 0 : msg.qty;
+    record.price = msg.corrupt == 4 ? std::numeric_limits<double>::quiet_NaN() : msg.price;
+    return record;
+  }
+}
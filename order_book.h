@@ -2,10 +2,18 @@
 
 #include "types.h"
 #include "utils.h"
+#include "book_checkpoint.h"
+#include "book_capacity.h"
+#include "pool_memory.h"
+#include "latency_stats.h"
+#include "event_tracer.h"
 
 #include <unordered_map>
+#include <iostream>
 #include <vector>
 #include <cassert>
+#include <algorithm>
+#include <type_traits>
 
 #include <boost/pool/pool_alloc.hpp>
 #include <boost/pool/object_pool.hpp>
@@ -33,7 +41,7 @@ namespace order_book
   
   using price_level_map_alloc_t = 
             boost::fast_pool_allocator<std::pair<const price_t, PriceLevel*>, 
-                        boost::default_user_allocator_new_delete, boost::details::pool::null_mutex, 64, 0>;
+                        PoolMemory<>, boost::details::pool::null_mutex, 64, 0>;
   
   using price_level_map_t = std::unordered_map<
           price_t, PriceLevel*, std::hash<price_t>, std::equal_to<price_t>, price_level_map_alloc_t>;
@@ -94,7 +102,8 @@ namespace order_book
       return head_order == nullptr;
     }
 
-    void print(std::ostream& os) const
+    template<typename stream_t>
+    void print(stream_t& os) const
     {
       os << get_qty() << " @ " << get_price() << " - ";
       assert(head_order);
@@ -105,10 +114,36 @@ namespace order_book
         os << "(" << temp->id << "," << temp->qty << ")";
         temp = temp->get_next();
       }
-      os << "]" << std::endl;
+      os << "]\n";
     }
   };
 
+  //construct and destroy count objects up front so the pool already holds them in touched memory
+  //they are destroyed in reverse, which lets object_pool's ordered free insert each one at the head of its free list
+  template<typename constructor_t>
+  inline void prefault_pool(constructor_t& constructor, size_t count)
+  {
+    using object_t = typename std::remove_pointer<decltype(constructor.construct())>::type;
+    std::vector<object_t*> objects;
+    objects.reserve(count);
+    for(size_t i = 0; i < count; ++i)
+    {
+      objects.push_back(constructor.construct());
+    }
+
+    for(auto iter = objects.rbegin(); iter != objects.rend(); ++iter)
+    {
+      constructor.destroy(*iter);
+    }
+  }
+
+  //notified by a book whenever the best price of one of its sides changes, the price is NaN once the side is empty
+  struct BookListener
+  {
+    virtual ~BookListener() {}
+    virtual void on_top_changed(SideType side, price_t price) = 0;
+  };
+
   template<typename price_level_constructor_t>
   class PriceBook
   {
@@ -117,17 +152,43 @@ namespace order_book
       PriceBook(SideType s, price_level_constructor_t& plc) : side_(s), price_level_constructor_(plc)
       {
         price_level_map_.reserve(128);
-        //warm up pool
-        price_level_map_.emplace(1.1, nullptr);
-        price_level_map_.erase(1.1);
       }
 
-      void add_order(Order& order)
+      //presize the level index and fill its node pool with num_levels placeholder entries
+      //which stay until end_warm_up, so both sides of a book hold their nodes at the same time
+      void begin_warm_up(size_t num_levels)
+      {
+        price_level_map_.reserve(num_levels);
+        for(size_t i = 0; i < num_levels; ++i)
+        {
+          price_level_map_.emplace(-1.0 - i, nullptr);
+        }
+      }
+
+      void end_warm_up()
+      {
+        assert(empty());
+        price_level_map_.clear();
+      }
+
+      //level is the existing level of the order's price when the caller already looked it up, nullptr otherwise
+      void add_order(Order& order, PriceLevel* level = nullptr)
       {
         //find and update level, insert order into the list, update order with the level
-        auto price_level = get_and_update_level(order.side, order.price);
+        bool top_changed = false;
+        auto price_level = level ? level : get_and_update_level(order.side, order.price, top_changed);
         assert(price_level);
         price_level->add_order(order);
+        //announced once the order is linked, so a listener reading the book sees the new top complete
+        if(top_changed)
+        {
+          TRACE_EVENT(top_changed, side_, 0, 0, order.price);
+          notify_top(order.price);
+        }
+        if(UNLIKELY(price_level_map_.size() > max_levels_))
+        {
+          max_levels_ = price_level_map_.size();
+        }
       }
       
       void cancel_order(Order& order)
@@ -140,9 +201,12 @@ namespace order_book
         //if this level is empth after the order is cancelled, need to remove the level;
         if(order.level->empty())
         {
+          TRACE_EVENT(level_destroyed, side_, order.id, 0, order.price);
           if(top_level_ == order.level)
           {
             top_level_ = order.level->get_next();
+            TRACE_EVENT(top_changed, side_, 0, 0, top_level_ ? top_level_->get_price() : 0);
+            notify_top(top_level_ ? top_level_->get_price() : std::numeric_limits<double>::quiet_NaN());
           }
 
           if(last_level_ == order.level)
@@ -156,11 +220,12 @@ namespace order_book
         }
       }
     
-      void print(std::ostream& os) const
+      template<typename stream_t>
+      void print(stream_t& os) const
       {
         if(top_level_ == nullptr)
         {
-          os << "* EMPTY *" << std::endl;
+          os << "* EMPTY *\n";
           return;
         }
         
@@ -199,15 +264,165 @@ namespace order_book
         return std::numeric_limits<double>::quiet_NaN();
       }
 
+      //call func(price, qty) for up to depth levels starting from the top of book
+      template<typename func_t>
+      size_t visit_levels(size_t depth, func_t&& func) const
+      {
+        size_t count = 0;
+        auto temp = top_level_;
+        while(temp && count < depth)
+        {
+          func(temp->get_price(), temp->get_qty());
+          temp = temp->get_next();
+          ++count;
+        }
+
+        return count;
+      }
+
+      size_t num_levels() const
+      {
+        return price_level_map_.size();
+      }
+
+      //existing level of the price, prefetched for an order about to join it, nullptr for a new level
+      PriceLevel* prefetch_level(price_t price) const
+      {
+        auto iter = price_level_map_.find(price);
+        if(iter == price_level_map_.end())
+        {
+          return nullptr;
+        }
+
+        PREFETCH(iter->second);
+        return iter->second;
+      }
+
+      void set_listener(BookListener* listener)
+      {
+        listener_ = listener;
+      }
+
+      //most levels this side held at once
+      size_t max_levels() const
+      {
+        return max_levels_;
+      }
+
+      //levels from top to bottom, each with its orders in fifo order
+      void save_checkpoint(CheckpointWriter& writer) const
+      {
+        writer.put<uint64_t>(price_level_map_.size());
+        auto level = top_level_;
+        while(level)
+        {
+          writer.put<price_t>(level->get_price());
+
+          uint32_t num_orders = 0;
+          for(auto order = level->head_order; order; order = order->get_next())
+          {
+            ++num_orders;
+          }
+          writer.put<uint32_t>(num_orders);
+
+          for(auto order = level->head_order; order; order = order->get_next())
+          {
+            writer.put<order_id_t>(order->id);
+            writer.put<qty_t>(order->qty);
+          }
+
+          level = level->get_next();
+        }
+      }
+
+      //bulk load into an empty side, levels are appended at the tail since they are saved in book order
+      //make_order(id, qty, price) returns the new order or nullptr to reject it
+      template<typename order_factory_t>
+      bool load_checkpoint(CheckpointReader& reader, order_factory_t&& make_order)
+      {
+        assert(empty());
+
+        uint64_t num_levels = 0;
+        if(!reader.get(num_levels))
+        {
+          return false;
+        }
+        price_level_map_.reserve(num_levels);
+
+        for(uint64_t i = 0; i < num_levels; ++i)
+        {
+          price_t price = 0;
+          uint32_t num_orders = 0;
+          if(!reader.get(price) || !reader.get(num_orders) || num_orders == 0 || !(price > 0))
+          {
+            return false;
+          }
+
+          //levels must be strictly ordered from the top of book
+          if(last_level_ && (side_ == SideType::bid ? price >= last_level_->get_price() 
+                                                      : price <= last_level_->get_price()))
+          {
+            return false;
+          }
+
+          auto level = price_level_constructor_.construct();
+          if(last_level_)
+          {
+            level->insert_after(*last_level_);
+          }
+          else
+          {
+            top_level_ = level;
+          }
+          last_level_ = level;
+          level->iter_in_map = price_level_map_.emplace(price, level).first;
+
+          for(uint32_t j = 0; j < num_orders; ++j)
+          {
+            order_id_t id = 0;
+            qty_t qty = 0;
+            if(!reader.get(id) || !reader.get(qty))
+            {
+              return false;
+            }
+
+            auto order = make_order(id, qty, price);
+            if(!order)
+            {
+              return false;
+            }
+            level->add_order(*order);
+          }
+        }
+
+        max_levels_ = std::max<size_t>(max_levels_, price_level_map_.size());
+        if(top_level_)
+        {
+          notify_top(top_level_->get_price());
+        }
+        return true;
+      }
+
     private:
 
-      PriceLevel* get_and_update_level(SideType side, price_t price)
+      void notify_top(price_t price)
+      {
+        if(listener_)
+        {
+          listener_->on_top_changed(side_, price);
+        }
+      }
+
+      //top_changed is set when the level is created at the top, the caller announces it once the order joined
+      PriceLevel* get_and_update_level(SideType side, price_t price, bool& top_changed)
       {
         if(top_level_ == nullptr)
         {
           top_level_ = price_level_constructor_.construct();
           last_level_ = top_level_;
           top_level_->iter_in_map = price_level_map_.emplace(price, top_level_).first;
+          TRACE_EVENT(level_created, side_, 0, 0, price);
+          top_changed = true;
           return top_level_;
         }
         
@@ -240,6 +455,8 @@ namespace order_book
               }
 
               new_level->iter_in_map = price_level_map_.emplace(price, new_level).first;
+              TRACE_EVENT(level_created, side_, 0, 0, price);
+              top_changed = top_level_ == new_level;
               return new_level;
             } 
             
@@ -265,6 +482,8 @@ namespace order_book
                 top_level_ = new_level;
               }
               new_level->iter_in_map = price_level_map_.emplace(price, new_level).first;
+              TRACE_EVENT(level_created, side_, 0, 0, price);
+              top_changed = top_level_ == new_level;
               return new_level;
             } 
             
@@ -279,6 +498,7 @@ namespace order_book
         last_level_ = new_level;
 
         new_level->iter_in_map = price_level_map_.emplace(price, new_level).first;
+        TRACE_EVENT(level_created, side_, 0, 0, price);
         return new_level;
       }
 
@@ -290,40 +510,73 @@ namespace order_book
       price_level_constructor_t& price_level_constructor_;
 
       price_level_map_t price_level_map_;
+      size_t max_levels_ = 0;
+      BookListener* listener_ = nullptr;
   };
 
+  using order_map_alloc_t = 
+            boost::fast_pool_allocator<std::pair<const order_id_t, Order*>, 
+                        PoolMemory<>, boost::details::pool::null_mutex, 8192, 0>;
+
+  using order_map_t = std::unordered_map<
+          order_id_t, Order*, std::hash<order_id_t>, std::equal_to<order_id_t>, order_map_alloc_t>;
+
+  //index entry of an order id found by OrderBook::prefetch_order, handed back to amend_order and cancel_order
+  using order_lookup_t = order_map_t::const_iterator;
+
   template<typename order_constructor_t = DefaultConstructor<Order>, 
             typename price_level_constructor_t = DefaultConstructor<PriceLevel>>
   class OrderBook
   {
     public:
       
-      OrderBook(InvalidStats& stats) : invalid_stats_(stats), 
-                    order_constructor_(8192), price_level_constructor_(128)
+      //the indices and pools are presized and warmed up for the capacity, so a session staying within it
+      //neither rehashes nor grows a pool
+      OrderBook(InvalidStats& stats, const BookCapacity& capacity = BookCapacity()) : invalid_stats_(stats), 
+                    order_constructor_(std::max<uint64_t>(8192, capacity.max_orders)), 
+                    price_level_constructor_(std::max<uint64_t>(128, 2 * capacity.max_levels))
       {
-        order_map_.reserve(1024);
+        const size_t num_orders = std::max<uint64_t>(1, capacity.max_orders);
+        const size_t num_levels = std::max<uint64_t>(1, capacity.max_levels);
+        order_map_.reserve(std::max<size_t>(1024, num_orders));
+        for(auto& book : book_)
+        {
+          book.begin_warm_up(num_levels);
+        }
 
         //warm up pool
-        order_map_.emplace(1,nullptr);
-        order_map_.erase(1);
+        for(size_t i = 0; i < num_orders; ++i)
+        {
+          order_map_.emplace(i + 1, nullptr);
+        }
+        order_map_.clear();
+        for(auto& book : book_)
+        {
+          book.end_warm_up();
+        }
 
-        order_constructor_.destroy(order_constructor_.construct());
-        price_level_constructor_.destroy(price_level_constructor_.construct());
+        prefault_pool(order_constructor_, num_orders);
+        prefault_pool(price_level_constructor_, 2 * num_levels);
       }
 
-      bool add_order(order_id_t order_id, SideType side, qty_t qty, price_t price)
+      //level is what prefetch_level returned for the side and price, the book must not have changed since
+      bool add_order(order_id_t order_id, SideType side, qty_t qty, price_t price, PriceLevel* level = nullptr)
       {
         //if book is cross when receiving a new order, update the stats
         if(is_cross())
         {
           ++ invalid_stats_.num_crossed;
+          TRACE_INVALID(crossed, order_id);
         }
 
         //check if duplicate order
+        LATENCY_BEGIN(index_start);
         auto new_order_iter = order_map_.emplace(order_id, nullptr);
+        LATENCY_END(index_start, LatencyProbe::index_lookup);
         if(!new_order_iter.second)
         {
           ++ invalid_stats_.num_duplicate_order;
+          TRACE_INVALID(duplicate_order, order_id);
           return false;
         }
         
@@ -337,31 +590,53 @@ namespace order_book
 
         //update the order map with the new order
         new_order_iter.first->second = new_order;
+        if(UNLIKELY(order_map_.size() > max_orders_))
+        {
+          max_orders_ = order_map_.size();
+        }
 
         //add to price book
-        book_[static_cast<int>(side)].add_order(*new_order);  
+        TRACE_EVENT(order_add, side, order_id, qty, price);
+        LATENCY_BEGIN(level_start);
+        book_[static_cast<int>(side)].add_order(*new_order, level);  
+        LATENCY_END(level_start, LatencyProbe::level_update);
         
         return true;
       }
 
       bool amend_order(order_id_t order_id, SideType side, qty_t qty, price_t price)
       { 
+        LATENCY_BEGIN(index_start);
+        order_lookup_t iter = order_map_.find(order_id);
+        LATENCY_END(index_start, LatencyProbe::index_lookup);
+        return amend_order(iter, order_id, side, qty, price);
+      }
+
+      //iter and level are what prefetch_order and prefetch_level returned, the book must not have changed since
+      bool amend_order(order_lookup_t iter, order_id_t order_id, SideType side, qty_t qty, price_t price,
+                       PriceLevel* level = nullptr)
+      { 
+        //the id is only traced
+        (void)order_id;
         //if book is cross when receiving a amend order, update the stats
         if(is_cross())
         {
           ++ invalid_stats_.num_crossed;
+          TRACE_INVALID(crossed, order_id);
         }
 
-        auto iter = order_map_.find(order_id);
         //check if order exists
         if(UNLIKELY(iter == order_map_.end()))
         {
           ++ invalid_stats_.num_unknown_mod;
+          TRACE_INVALID(unknown_mod, order_id);
           return false;
         }
 
         assert(iter->second);
         auto& order = *(iter->second);
+        TRACE_EVENT(order_amend, side, order_id, qty, price);
+        LATENCY_BEGIN(level_start);
         //if side or price change the previous order should be cancelled and a new order should be added
         if(side != order.side || price != order.price)
         {
@@ -370,7 +645,8 @@ namespace order_book
           order.side = side;
           order.qty = qty;
           order.price = price;
-          book_[static_cast<int>(order.side)].add_order(order);  
+          book_[static_cast<int>(order.side)].add_order(order, level);  
+          LATENCY_END(level_start, LatencyProbe::level_update);
           return true;
         }
         //otherwise only qty change just update in place
@@ -381,6 +657,7 @@ namespace order_book
           order.level->total_qty -= order.qty;
           order.qty = qty; 
 
+          LATENCY_END(level_start, LatencyProbe::level_update);
           return true;
         }
         else
@@ -392,16 +669,30 @@ namespace order_book
 
       bool cancel_order(order_id_t order_id)
       {
-        auto iter = order_map_.find(order_id);
+        LATENCY_BEGIN(index_start);
+        order_lookup_t iter = order_map_.find(order_id);
+        LATENCY_END(index_start, LatencyProbe::index_lookup);
+        return cancel_order(iter, order_id);
+      }
+
+      //iter is what prefetch_order returned for the id, the book must not have changed since
+      bool cancel_order(order_lookup_t iter, order_id_t order_id)
+      {
+        //the id is only traced
+        (void)order_id;
         //check if order exists
         if(UNLIKELY(iter == order_map_.end()))
         {
           ++ invalid_stats_.num_unknown_mod;
+          TRACE_INVALID(unknown_mod, order_id);
           return false;
         }
         
         assert(iter->second);
+        TRACE_EVENT(order_cancel, iter->second->side, order_id, iter->second->qty, iter->second->price);
+        LATENCY_BEGIN(level_start);
         book_[static_cast<int>(iter->second->side)].cancel_order(*(iter->second));
+        LATENCY_END(level_start, LatencyProbe::level_update);
         
         order_constructor_.destroy(iter->second);
         
@@ -409,18 +700,20 @@ namespace order_book
         return true;
       }
       
-      void print(std::ostream& os) const
+      //stream_t is a std::ostream or an AsyncBookWriter, both produce the same bytes
+      template<typename stream_t>
+      void print(stream_t& os) const
       {
-          double mid_quote = (book_[static_cast<int>(SideType::bid)].get_tob() + 
+        double mid_quote = (book_[static_cast<int>(SideType::bid)].get_tob() + 
                             book_[static_cast<int>(SideType::ask)].get_tob()) /2;
 
-        os << std::endl;
-        os << "*** ask ***" << std::endl;
+        os << "\n";
+        os << "*** ask ***\n";
         book_[static_cast<int>(SideType::ask)].print(os);
-        std::cout << "========" << mid_quote << "========" << std::endl;
+        os << "========" << mid_quote << "========\n";
         book_[static_cast<int>(SideType::bid)].print(os);
-        os << "*** bid ***" << std::endl;
-        os << std::endl;
+        os << "*** bid ***\n";
+        os << "\n";
       }
       
       bool is_cross() const
@@ -441,18 +734,146 @@ namespace order_book
         return book_[static_cast<int>(side)].get_tob();
       }
 
+      template<typename func_t>
+      size_t visit_levels(SideType side, size_t depth, func_t&& func) const
+      {
+        assert(side == SideType::bid || side == SideType::ask);
+        return book_[static_cast<int>(side)].visit_levels(depth, std::forward<func_t>(func));
+      }
+
+      size_t num_orders() const
+      {
+        return order_map_.size();
+      }
+
+      //staged prefetches of the nodes a message is about to touch, so one thread driving several books can
+      //overlap their cache misses. the index and level map lookups run right away, std::unordered_map does not
+      //expose its buckets, and the nodes they return are prefetched for the next stage. nothing is modified,
+      //the lookups are handed to add_order, amend_order and cancel_order so they are not repeated
+
+      //order of the id prefetched, nullptr when unknown, iter set to its index entry. for a new id the lookup
+      //still warms the bucket add_order inserts into
+      const Order* prefetch_order(order_id_t order_id, order_lookup_t& iter) const
+      {
+        iter = order_map_.find(order_id);
+        if(iter == order_map_.end())
+        {
+          return nullptr;
+        }
+
+        PREFETCH(iter->second);
+        return iter->second;
+      }
+
+      //level and neighbours relinked when the order, prefetched by an earlier stage, is cancelled or moved
+      void prefetch_order_links(const Order* order) const
+      {
+        if(order)
+        {
+          PREFETCH(order->level);
+          PREFETCH(order->prev);
+          PREFETCH(order->next);
+        }
+      }
+
+      PriceLevel* prefetch_level(SideType side, price_t price) const
+      {
+        if(side != SideType::bid && side != SideType::ask)
+        {
+          return nullptr;
+        }
+        return book_[static_cast<int>(side)].prefetch_level(price);
+      }
+
+      //order a new order is linked after, the level was prefetched by an earlier stage
+      void prefetch_level_tail(const PriceLevel* level) const
+      {
+        if(level)
+        {
+          PREFETCH(level->tail_order);
+        }
+      }
+
+      //one listener per book for the top of book changes of both sides, nullptr to stop the notifications
+      void set_listener(BookListener* listener)
+      {
+        for(auto& book : book_)
+        {
+          book.set_listener(listener);
+        }
+      }
+
+      //high water marks since construction, what a later run should be presized for
+      BookCapacity high_water() const
+      {
+        BookCapacity capacity;
+        capacity.max_orders = max_orders_;
+        capacity.max_levels = std::max(book_[0].max_levels(), book_[1].max_levels());
+        return capacity;
+      }
+
+      void save_checkpoint(CheckpointWriter& writer) const
+      {
+        writer.reserve(writer.size() + order_map_.size() * (sizeof(order_id_t) + sizeof(qty_t)) + 
+                        (book_[0].num_levels() + book_[1].num_levels()) * (sizeof(price_t) + sizeof(uint32_t)) + 64);
+        writer.put<uint64_t>(order_map_.size());
+        book_[static_cast<int>(SideType::bid)].save_checkpoint(writer);
+        book_[static_cast<int>(SideType::ask)].save_checkpoint(writer);
+      }
+
+      //restore into an empty book straight into the pools and indices, no per message processing
+      //the invalid stats are not part of the book image, on failure the book must be discarded
+      bool load_checkpoint(CheckpointReader& reader)
+      {
+        assert(order_map_.empty());
+
+        uint64_t num_orders = 0;
+        if(!reader.get(num_orders) || num_orders > reader.remaining())
+        {
+          return false;
+        }
+        order_map_.reserve(num_orders);
+
+        for(auto side : {SideType::bid, SideType::ask})
+        {
+          auto make_order = [this, side](order_id_t id, qty_t qty, price_t price) -> Order*
+          {
+            auto iter = order_map_.emplace(id, nullptr);
+            if(!iter.second)
+            {
+              return nullptr;
+            }
+
+            auto order = order_constructor_.construct();
+            if(UNLIKELY(!order))
+            {
+              order_map_.erase(iter.first);
+              return nullptr;
+            }
+            *order = {id, side, qty, price, nullptr};
+            iter.first->second = order;
+            return order;
+          };
+
+          if(!book_[static_cast<int>(side)].load_checkpoint(reader, make_order))
+          {
+            return false;
+          }
+        }
+
+        max_orders_ = std::max<size_t>(max_orders_, order_map_.size());
+        return order_map_.size() == num_orders;
+      }
+
     private:
       
       using price_book_t = PriceBook<price_level_constructor_t>;
       price_book_t book_[static_cast<int>(SideType::cardinality)] = {{SideType::bid, price_level_constructor_}, 
                                                                           {SideType::ask, price_level_constructor_}};     
-      using order_map_alloc_t = 
-              boost::fast_pool_allocator<std::pair<const order_id_t, Order*>, 
-                        boost::default_user_allocator_new_delete, boost::details::pool::null_mutex, 8192, 0>;
-      using order_map_t = std::unordered_map<
-          order_id_t, Order*, std::hash<order_id_t>, std::equal_to<order_id_t>, order_map_alloc_t>;
       order_map_t order_map_;
 
+      size_t max_orders_ = 0;
+
       InvalidStats& invalid_stats_;
       order_constructor_t order_constructor_;
       price_level_constructor_t price_level_constructor_;
@@ -1,58 +1,998 @@
 
 #include "benchmark/benchmark.h"
 
-#include "order_book.h"
+#include "feed_handler.h"
+#include "consolidated_book.h"
+#include "feed_file_writer.h"
+#include "feed_reader.h"
+#include "message_generator.h"
+#include "shm_book.h"
+#ifdef ORDER_BOOK_COROUTINES
+#include "interleaved_replay.h"
+#endif
+
+#include <boost/iostreams/device/file.hpp>
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
 
 using namespace order_book;
 
-static InvalidStats is;
-static OrderBook<boost::object_pool<Order>, boost::object_pool<PriceLevel>> g_order_book(is);
+using book_t = OrderBook<boost::object_pool<Order>, boost::object_pool<PriceLevel>>;
 
-static void BM_ORDER_BOOK_ADD_ORDER(benchmark::State& state) 
+namespace
 {
-  order_id_t order_id = 0;
-  qty_t qty = 1;
-  price_t price = 10;
-  SideType side = SideType::bid;
-  while (state.KeepRunning()) 
+  constexpr size_t kStreamSize = 1 << 20;
+  constexpr size_t kBatchSize = 1 << 14;
+
+  const char* kDistributionNames[] = {"uniform", "touch", "zipf"};
+  const char* kMixNames[] = {"add_cancel", "realistic", "amend_heavy"};
+
+  //add, mod, del, trade weights of each mix
+  const uint32_t kMixes[][4] = {{50, 0, 50, 0}, {45, 10, 40, 5}, {20, 60, 20, 0}};
+
+  //feed reading of BM_FEED_READER_FRAMING and BM_FEED_READER_REPLAY, the getline loop FeedReader replaced then
+  //FeedReader per compression
+  const char* kFeedReadNames[] = {"ifstream", "none", "gzip", "zstd", "lz4"};
+
+  //how BM_INTERLEAVED_REPLAY drives its books: each feed to its end in turn, a message of every feed in turn,
+  //or the prefetching coroutines of interleaved_replay.h, built with -DORDER_BOOK_COROUTINES=ON
+  const char* kReplayModeNames[] = {"sequential", "round_robin", "coroutine"};
+#ifdef ORDER_BOOK_COROUTINES
+  const int kNumReplayModes = 3;
+#else
+  const int kNumReplayModes = 2;
+#endif
+}
+
+//every benchmark gets its own book: state.range(0) price levels per side holding state.range(1) resting orders,
+//prices drawn from PriceDistribution state.range(2). the generator is seeded so runs are reproducible
+class OrderBookFixture : public benchmark::Fixture
+{
+  public:
+
+    void SetUp(const benchmark::State& state) override
+    {
+      GeneratorConfig config;
+      config.depth = state.range(0);
+      config.resting_orders = state.range(1);
+      config.price_distribution = static_cast<PriceDistribution>(state.range(2));
+      config.mid_price = 1000;
+
+      generator_.reset(new MessageGenerator(config));
+      prefill_.clear();
+      generator_->prefill(prefill_);
+      rebuild();
+    }
+
+    void TearDown(const benchmark::State&) override
+    {
+      book_.reset();
+      generator_.reset();
+      prefill_.clear();
+      prefill_.shrink_to_fit();
+    }
+
+  protected:
+
+    //fresh book holding only the resting orders
+    void rebuild()
+    {
+      book_.reset();
+      stats_ = InvalidStats();
+      book_.reset(new book_t(stats_));
+      for(auto& msg : prefill_)
+      {
+        applyMessage(*book_, msg);
+      }
+    }
+
+    std::vector<Message> makeStream(int mix, size_t count)
+    {
+      generator_->setMix(kMixes[mix][0], kMixes[mix][1], kMixes[mix][2], kMixes[mix][3]);
+      std::vector<Message> stream;
+      generator_->generate(stream, count);
+      return stream;
+    }
+
+    //the stream is only valid against the book it was generated for, replay it from a rebuilt book once exhausted
+    void wrap(benchmark::State& state, size_t& index, size_t size)
+    {
+      if(UNLIKELY(index == size))
+      {
+        state.PauseTiming();
+        rebuild();
+        index = 0;
+        state.ResumeTiming();
+      }
+    }
+
+    InvalidStats stats_;
+    std::unique_ptr<book_t> book_;
+    std::unique_ptr<MessageGenerator> generator_;
+    std::vector<Message> prefill_;
+};
+
+static void setLabel(benchmark::State& state, int mix)
+{
+  std::string label = kDistributionNames[state.range(2)];
+  if(mix >= 0)
+  {
+    label += "/";
+    label += kMixNames[mix];
+  }
+  state.SetLabel(label);
+}
+
+//new orders at prices from the distribution, the batch is cancelled untimed before it is added again
+BENCHMARK_DEFINE_F(OrderBookFixture, BM_ORDER_BOOK_ADD_ORDER)(benchmark::State& state)
+{
+  std::vector<Message> adds;
+  generator_->setMix(1, 0, 0, 0);
+  generator_->generate(adds, kBatchSize);
+
+  size_t index = 0;
+  for (auto _ : state)
   {
-    benchmark::DoNotOptimize(g_order_book.add_order(++order_id, side, (++qty)%100, (++price)));
-    side = static_cast<SideType>(!static_cast<int>(side));
-    if(price >=20)
+    if(UNLIKELY(index == adds.size()))
     {
-      price = 10;
+      state.PauseTiming();
+      for(auto& msg : adds)
+      {
+        book_->cancel_order(msg.id);
+      }
+      index = 0;
+      state.ResumeTiming();
     }
+    benchmark::DoNotOptimize(applyMessage(*book_, adds[index++]));
   }
+
+  setLabel(state, -1);
+  state.SetItemsProcessed(state.iterations());
 }
 
-static void BM_ORDER_BOOK_AMEND_ORDER(benchmark::State& state) 
+//half of the amends change the quantity in place, half move the order to another level
+BENCHMARK_DEFINE_F(OrderBookFixture, BM_ORDER_BOOK_AMEND_ORDER)(benchmark::State& state)
 {
-  order_id_t order_id = 0;
-  qty_t qty = 1;
-  price_t price = 21;
-  SideType side = SideType::bid;
+  std::vector<Message> amends;
+  generator_->setMix(0, 1, 0, 0);
+  generator_->generate(amends, kBatchSize);
 
-  while (state.KeepRunning()) 
+  size_t index = 0;
+  for (auto _ : state)
+  {
+    //a replayed batch would only set what the orders already hold, the generator tracks the amended orders
+    //so the next batch changes them again
+    if(UNLIKELY(index == amends.size()))
+    {
+      state.PauseTiming();
+      amends.clear();
+      generator_->generate(amends, kBatchSize);
+      index = 0;
+      state.ResumeTiming();
+    }
+    benchmark::DoNotOptimize(applyMessage(*book_, amends[index++]));
+  }
+
+  setLabel(state, -1);
+  state.SetItemsProcessed(state.iterations());
+}
+
+//cancels of a batch of extra orders added untimed on top of the resting book
+BENCHMARK_DEFINE_F(OrderBookFixture, BM_ORDER_BOOK_CANCEL_ORDER)(benchmark::State& state)
+{
+  std::vector<Message> adds;
+  generator_->setMix(1, 0, 0, 0);
+  generator_->generate(adds, kBatchSize);
+
+  size_t index = adds.size();
+  for (auto _ : state)
+  {
+    if(UNLIKELY(index == adds.size()))
+    {
+      state.PauseTiming();
+      for(auto& msg : adds)
+      {
+        applyMessage(*book_, msg);
+      }
+      index = 0;
+      state.ResumeTiming();
+    }
+    benchmark::DoNotOptimize(book_->cancel_order(adds[index++].id));
+  }
+
+  setLabel(state, -1);
+  state.SetItemsProcessed(state.iterations());
+}
+
+//steady state message stream of mix state.range(3), reports messages per second
+BENCHMARK_DEFINE_F(OrderBookFixture, BM_ORDER_BOOK_MESSAGE_MIX)(benchmark::State& state)
+{
+  auto stream = makeStream(state.range(3), kStreamSize);
+
+  size_t index = 0;
+  for (auto _ : state)
+  {
+    wrap(state, index, stream.size());
+    benchmark::DoNotOptimize(applyMessage(*book_, stream[index++]));
+  }
+
+  setLabel(state, state.range(3));
+  state.SetItemsProcessed(state.iterations());
+}
+
+//same stream as BM_ORDER_BOOK_MESSAGE_MIX with every operation timed by the tsc, reports per type percentiles
+BENCHMARK_DEFINE_F(OrderBookFixture, BM_ORDER_BOOK_OP_LATENCY)(benchmark::State& state)
+{
+  auto stream = makeStream(state.range(3), kStreamSize);
+  LatencyHistogram histograms[3];
+  const MessageType types[] = {MessageType::add, MessageType::mod, MessageType::del};
+
+  size_t index = 0;
+  for (auto _ : state)
+  {
+    wrap(state, index, stream.size());
+    auto& msg = stream[index++];
+
+    auto start = readTsc();
+    benchmark::DoNotOptimize(applyMessage(*book_, msg));
+    auto cycles = readTsc() - start;
+
+    for(int i = 0; i < 3; ++i)
+    {
+      if(msg.type == types[i])
+      {
+        histograms[i].record(cycles);
+      }
+    }
+  }
+
+  const double ratio = tscCyclesPerNs();
+  const char* names[] = {"add", "mod", "del"};
+  for(int i = 0; i < 3; ++i)
+  {
+    if(histograms[i].count() == 0)
+    {
+      continue;
+    }
+
+    std::string name = names[i];
+    state.counters[name + "_p50_ns"] = histograms[i].percentile(0.5) / ratio;
+    state.counters[name + "_p99_ns"] = histograms[i].percentile(0.99) / ratio;
+    state.counters[name + "_p99.9_ns"] = histograms[i].percentile(0.999) / ratio;
+  }
+
+  setLabel(state, state.range(3));
+  state.SetItemsProcessed(state.iterations());
+}
+
+//end to end replay of a recorded feed through FeedHandler, ORDER_BOOK_REPLAY_FILE overrides the bundled message.dat
+static void BM_FEED_HANDLER_REPLAY(benchmark::State& state)
+{
+  const char* path = std::getenv("ORDER_BOOK_REPLAY_FILE");
+  std::ifstream infile(path ? path : ORDER_BOOK_SOURCE_DIR "/message.dat", std::ios::in);
+  std::vector<std::string> lines;
+  std::string line;
+  uint64_t bytes = 0;
+  while(std::getline(infile, line))
+  {
+    bytes += line.size() + 1;
+    lines.push_back(line);
+  }
+
+  if(lines.empty())
+  {
+    state.SkipWithError("no feed to replay");
+    return;
+  }
+
+  for (auto _ : state)
+  {
+    state.PauseTiming();
+    std::unique_ptr<FeedHandler> feed(new FeedHandler());
+    state.ResumeTiming();
+
+    for(auto& msg : lines)
+    {
+      feed->processMessage(msg);
+    }
+
+    state.PauseTiming();
+    feed.reset();
+    state.ResumeTiming();
+  }
+
+  state.SetItemsProcessed(state.iterations() * lines.size());
+  state.SetBytesProcessed(state.iterations() * bytes);
+}
+
+//text feed of 1 << 21 generated messages on a book of 10000 resting orders, rendered once and shared by the
+//feed reader benchmarks. adds and cancels are balanced so the book keeps its size
+static const std::string& generatedFeed(GeneratorConfig& config)
+{
+  config.resting_orders = 10000;
+  config.mid_price = 1000;
+  config.add_weight = 45;
+  config.del_weight = 45;
+
+  static std::string feed;
+  if(feed.empty())
+  {
+    const std::string path = "/tmp/order_book_generated_feed." + std::to_string(getpid());
+    if(generateFeed(config, 1 << 21, path.c_str(), false))
+    {
+      std::ifstream infile(path, std::ios::in | std::ios::binary);
+      feed.assign(std::istreambuf_iterator<char>(infile), std::istreambuf_iterator<char>());
+    }
+    std::remove(path.c_str());
+  }
+  return feed;
+}
+
+//the prefill and count generated messages of config converted to the binary format, returns a capacity presized
+//so the pools of a book replaying them do not grow
+static BookCapacity makeBinaryFeed(const GeneratorConfig& config, size_t count, std::vector<BinaryMessage>& prefill,
+      std::vector<BinaryMessage>& stream)
+{
+  MessageGenerator generator(config);
+  std::vector<Message> messages;
+  generator.prefill(messages);
+  for(auto& msg : messages)
+  {
+    prefill.push_back(toBinaryMessage(msg));
+  }
+  messages.clear();
+  generator.generate(messages, count);
+  for(auto& msg : messages)
+  {
+    stream.push_back(toBinaryMessage(msg));
+  }
+
+  BookCapacity capacity;
+  capacity.max_orders = 2 * config.resting_orders;
+  capacity.max_levels = 4 * config.depth;
+  return capacity;
+}
+
+//write the feed to path as is or compressed as named by kFeedReadNames[mode], false when it cannot be written or
+//lz4 is not compiled in
+static bool writeFeedFile(const std::string& path, const std::string& feed, int mode)
+{
+  namespace io = boost::iostreams;
+  if(mode == 4)
+  {
+#ifdef ORDER_BOOK_HAVE_LZ4
+    std::vector<char> frame(LZ4F_compressFrameBound(feed.size(), nullptr));
+    auto size = LZ4F_compressFrame(frame.data(), frame.size(), feed.data(), feed.size(), nullptr);
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if(LZ4F_isError(size) || !file)
+    {
+      if(file)
+      {
+        std::fclose(file);
+      }
+      return false;
+    }
+    bool ok = std::fwrite(frame.data(), 1, size, file) == size;
+    return (std::fclose(file) == 0) && ok;
+#else
+    return false;
+#endif
+  }
+
+  io::filtering_ostream out;
+  if(mode == 2)
+  {
+    out.push(io::gzip_compressor());
+  }
+  else if(mode == 3)
+  {
+    out.push(io::zstd_compressor());
+  }
+  out.push(io::file_sink(path, std::ios::out | std::ios::binary));
+  out.write(feed.data(), feed.size());
+  out.reset();
+  return true;
+}
+
+//the feed written for kFeedReadNames[state.range(0)] to a temporary file, empty after SkipWithError
+static std::string prepareFeedFile(benchmark::State& state, GeneratorConfig& config)
+{
+  const auto& feed = generatedFeed(config);
+  const int mode = state.range(0);
+  const std::string path = "/tmp/order_book_feed_reader." + std::to_string(getpid()) + "." + kFeedReadNames[mode];
+  if(feed.empty() || !writeFeedFile(path, feed, mode))
+  {
+    state.SkipWithError(mode == 4 ? "lz4 is not compiled in" : "failed to write the feed file");
+    std::remove(path.c_str());
+    return std::string();
+  }
+  state.SetLabel(kFeedReadNames[mode]);
+  return path;
+}
+
+//line framing of a generated feed file without the book: the ifstream getline loop against FeedReader on the
+//plain file and on its gzip, zstd and lz4 compressions
+static void BM_FEED_READER_FRAMING(benchmark::State& state)
+{
+  GeneratorConfig config;
+  const std::string path = prepareFeedFile(state, config);
+  if(path.empty())
+  {
+    return;
+  }
+
+  uint64_t lines = 0;
+  uint64_t bytes = 0;
+  for (auto _ : state)
+  {
+    if(state.range(0) == 0)
+    {
+      std::ifstream infile(path, std::ios::in);
+      std::string line;
+      while(std::getline(infile, line))
+      {
+        ++lines;
+        bytes += line.size() + 1;
+        benchmark::DoNotOptimize(line.data());
+      }
+      continue;
+    }
+
+    FeedReader reader;
+    if(!reader.open(path.c_str()))
+    {
+      state.SkipWithError("failed to open the feed file");
+      break;
+    }
+
+    const char* line = nullptr;
+    size_t size = 0;
+    while(reader.next_line(line, size))
+    {
+      ++lines;
+      bytes += size + 1;
+      benchmark::DoNotOptimize(line);
+    }
+  }
+
+  std::remove(path.c_str());
+  state.SetItemsProcessed(lines);
+  state.SetBytesProcessed(bytes);
+}
+
+//the same generated feed replayed through a presized FeedHandler, read by the ifstream getline loop or by FeedReader
+//from the plain, gzip, zstd and lz4 files. the handler is rebuilt untimed for every pass
+static void BM_FEED_READER_REPLAY(benchmark::State& state)
+{
+  GeneratorConfig config;
+  const std::string path = prepareFeedFile(state, config);
+  if(path.empty())
+  {
+    return;
+  }
+
+  BookCapacity capacity;
+  capacity.max_orders = 4 * config.resting_orders;
+  capacity.max_levels = 4 * config.depth;
+
+  uint64_t lines = 0;
+  uint64_t bytes = 0;
+  std::unique_ptr<FeedHandler> feed;
+  for (auto _ : state)
+  {
+    state.PauseTiming();
+    feed.reset();
+    feed.reset(new FeedHandler(capacity));
+    state.ResumeTiming();
+
+    if(state.range(0) == 0)
+    {
+      std::ifstream infile(path, std::ios::in);
+      std::string line;
+      while(std::getline(infile, line))
+      {
+        feed->processMessage(line);
+        ++lines;
+        bytes += line.size() + 1;
+      }
+      continue;
+    }
+
+    FeedReader reader;
+    if(!reader.open(path.c_str()))
+    {
+      state.SkipWithError("failed to open the feed file");
+      break;
+    }
+
+    const char* line = nullptr;
+    size_t size = 0;
+    while(reader.next_line(line, size))
+    {
+      feed->processMessage(line, size);
+      ++lines;
+      bytes += size + 1;
+    }
+  }
+
+  std::remove(path.c_str());
+  state.SetItemsProcessed(lines);
+  state.SetBytesProcessed(bytes);
+}
+
+//state.range(1) books of state.range(2) resting orders, each replaying its own stream of 1 << 16 messages on this
+//thread, driven as named by kReplayModeNames[state.range(0)]. the books are rebuilt between iterations
+static void BM_INTERLEAVED_REPLAY(benchmark::State& state)
+{
+  const int mode = state.range(0);
+  const int num_books = state.range(1);
+  const uint64_t resting_orders = state.range(2);
+  constexpr size_t kMessagesPerBook = 1 << 16;
+
+  BookCapacity capacity;
+  std::vector<std::vector<BinaryMessage>> prefills(num_books);
+  std::vector<std::vector<BinaryMessage>> streams(num_books);
+  for(int i = 0; i < num_books; ++i)
+  {
+    GeneratorConfig config;
+    config.seed = i + 1;
+    config.depth = 100;
+    config.resting_orders = resting_orders;
+    config.mid_price = 1000;
+    capacity = makeBinaryFeed(config, kMessagesPerBook, prefills[i], streams[i]);
+  }
+
+  std::vector<std::unique_ptr<FeedHandler>> feeds(num_books);
+  for (auto _ : state)
+  {
+    state.PauseTiming();
+    for(int i = 0; i < num_books; ++i)
+    {
+      feeds[i].reset();
+      feeds[i].reset(new FeedHandler(capacity));
+      for(auto& msg : prefills[i])
+      {
+        feeds[i]->processMessage(msg);
+      }
+    }
+#ifdef ORDER_BOOK_COROUTINES
+    std::vector<ReplayTask> tasks;
+    if(mode == 2)
+    {
+      for(int i = 0; i < num_books; ++i)
+      {
+        tasks.push_back(replayInterleaved(*feeds[i], streams[i].data(), streams[i].data() + streams[i].size()));
+      }
+    }
+#endif
+    state.ResumeTiming();
+
+    if(mode == 0)
+    {
+      for(int i = 0; i < num_books; ++i)
+      {
+        for(auto& msg : streams[i])
+        {
+          feeds[i]->processMessage(msg);
+        }
+      }
+    }
+    else if(mode == 1)
+    {
+      for(size_t index = 0; index < kMessagesPerBook; ++index)
+      {
+        for(int i = 0; i < num_books; ++i)
+        {
+          feeds[i]->processMessage(streams[i][index]);
+        }
+      }
+    }
+#ifdef ORDER_BOOK_COROUTINES
+    else
+    {
+      runInterleaved(tasks);
+    }
+#endif
+  }
+
+  state.SetLabel(kReplayModeNames[mode]);
+  state.SetItemsProcessed(state.iterations() * num_books * kMessagesPerBook);
+}
+
+//bulk restore of a book with state.range(0) resting orders spread over 1000 price levels per side
+static void BM_ORDER_BOOK_CHECKPOINT_RESTORE(benchmark::State& state)
+{
+  CheckpointWriter writer;
   {
-    benchmark::DoNotOptimize(g_order_book.amend_order(++order_id, side, (++qty)%50, (++price)));
-    if(price >=40)
+    InvalidStats stats;
+    book_t book(stats);
+    for(order_id_t order_id = 1; order_id <= state.range(0); ++order_id)
     {
-      price = 21;
+      auto side = static_cast<SideType>(order_id & 1);
+      auto level = order_id % 1000;
+      book.add_order(order_id, side, order_id % 100 + 1, side == SideType::bid ? 1000 - level * 0.5 : 1001 + level * 0.5);
     }
+    book.save_checkpoint(writer);
+  }
+
+  while (state.KeepRunning()) 
+  {
+    InvalidStats stats;
+    std::unique_ptr<book_t> book(new book_t(stats));
+    CheckpointReader reader(writer.data(), writer.size());
+    benchmark::DoNotOptimize(book->load_checkpoint(reader));
+
+    state.PauseTiming();
+    book.reset();
+    state.ResumeTiming();
   }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
 }
 
-static void BM_ORDER_BOOK_CANCEL_ORDER(benchmark::State& state) 
+//cost of one trace event on the recording thread, the flusher drains to /dev/null
+static void BM_EVENT_TRACER_RECORD(benchmark::State& state)
 {
+  if(!EventTracer<>::start("/dev/null"))
+  {
+    state.SkipWithError("failed to start the tracer");
+    return;
+  }
+
   order_id_t order_id = 0;
   while (state.KeepRunning()) 
   {
-    benchmark::DoNotOptimize(g_order_book.cancel_order(++order_id));
+    EventTracer<>::record(TraceEventType::order_add, SideType::bid, ++order_id, 1, 10, 0);
+  }
+
+  EventTracer<>::stop();
+  state.counters["lost"] = EventTracer<>::num_lost();
+}
+
+//writer update to reader visibility through the shared memory seqlock, the writer waits for the
+//reader to observe each update so every publish is measured once
+static void BM_SHM_PUBLISH_TO_READ(benchmark::State& state)
+{
+  const std::string name = "/order_book_bench_" + std::to_string(getpid());
+  ShmBookWriter writer;
+  ShmBookReader reader;
+  if(!writer.open(name.c_str(), 1) || !reader.open(name.c_str()))
+  {
+    state.SkipWithError("failed to create shared memory book");
+    return;
+  }
+
+  std::atomic<uint64_t> acked(0);
+  std::atomic<bool> done(false);
+  uint64_t total_ns = 0;
+  uint64_t samples = 0;
+
+  uint64_t last_seq = reader.sequence(0);
+  std::thread reader_thread([&]()
+  {
+    ShmBookSnapshot snapshot;
+    while(!done.load(std::memory_order_acquire))
+    {
+      if(reader.sequence(0) == last_seq)
+      {
+        std::this_thread::yield();
+        continue;
+      }
+
+      if(!reader.read(0, snapshot, last_seq))
+      {
+        continue;
+      }
+      total_ns += steadyNowNs() - snapshot.publish_ns;
+      ++samples;
+      acked.store(snapshot.msg_seq, std::memory_order_release);
+    }
+  });
+
+  uint64_t msg_seq = 0;
+  while (state.KeepRunning())
+  {
+    ++msg_seq;
+    writer.publish(0, [msg_seq](ShmBookSnapshot& snapshot)
+    {
+      snapshot.msg_seq = msg_seq;
+      snapshot.num_levels[0] = snapshot.num_levels[1] = kShmBookDepth;
+    });
+
+    while(acked.load(std::memory_order_acquire) < msg_seq)
+    {
+      std::this_thread::yield();
+    }
+  }
+
+  done.store(true, std::memory_order_release);
+  reader_thread.join();
+  ShmBookWriter::unlink(name.c_str());
+
+  state.counters["visibility_ns"] = samples ? static_cast<double>(total_ns) / samples : 0;
+}
+
+//writer latency of FeedHandler publishing a BookSnapshotBuffer after every message while state.range(1) threads
+//keep copying it, state.range(0) zero runs the feed without publishing. readers check every copy for a crossed
+//or out of order depth, which a torn snapshot would show
+static void BM_BOOK_SNAPSHOT_READERS(benchmark::State& state)
+{
+  const bool publish = state.range(0);
+  const int num_readers = state.range(1);
+
+  GeneratorConfig config;
+  config.depth = 100;
+  config.resting_orders = 10000;
+  config.mid_price = 1000;
+  std::vector<BinaryMessage> prefill;
+  std::vector<BinaryMessage> stream;
+  //presized so the pools do not grow under the writer
+  const BookCapacity capacity = makeBinaryFeed(config, kStreamSize, prefill, stream);
+
+  BookSnapshotBuffer buffer;
+  std::unique_ptr<FeedHandler> feed;
+  auto rebuild = [&]()
+  {
+    feed.reset(new FeedHandler(capacity));
+    for(auto& msg : prefill)
+    {
+      feed->processMessage(msg);
+    }
+    if(publish)
+    {
+      feed->enableLocalPublish(buffer);
+    }
+  };
+  rebuild();
+
+  std::atomic<bool> done(false);
+  std::atomic<uint64_t> reads(0);
+  std::atomic<uint64_t> inconsistent(0);
+  std::vector<std::thread> readers;
+  for(int i = 0; i < num_readers; ++i)
+  {
+    readers.emplace_back([&]()
+    {
+      ShmBookSnapshot snapshot;
+      uint64_t count = 0;
+      uint64_t bad = 0;
+      while(!done.load(std::memory_order_relaxed))
+      {
+        buffer.read(snapshot);
+        ++count;
+
+        auto bids = snapshot.levels[static_cast<int>(SideType::bid)];
+        auto asks = snapshot.levels[static_cast<int>(SideType::ask)];
+        auto num_bids = snapshot.num_levels[static_cast<int>(SideType::bid)];
+        auto num_asks = snapshot.num_levels[static_cast<int>(SideType::ask)];
+        bool ok = num_bids <= kShmBookDepth && num_asks <= kShmBookDepth;
+        for(uint32_t level = 1; ok && level < num_bids; ++level)
+        {
+          ok = bids[level].price < bids[level - 1].price;
+        }
+        for(uint32_t level = 1; ok && level < num_asks; ++level)
+        {
+          ok = asks[level].price > asks[level - 1].price;
+        }
+        bad += !ok;
+      }
+      reads += count;
+      inconsistent += bad;
+    });
+  }
+
+  LatencyHistogram histogram;
+  size_t index = 0;
+  for (auto _ : state)
+  {
+    if(UNLIKELY(index == stream.size()))
+    {
+      state.PauseTiming();
+      rebuild();
+      index = 0;
+      state.ResumeTiming();
+    }
+
+    auto start = readTsc();
+    feed->processMessage(stream[index++]);
+    histogram.record(readTsc() - start);
+  }
+
+  done.store(true, std::memory_order_relaxed);
+  for(auto& reader : readers)
+  {
+    reader.join();
+  }
+
+  const double ratio = tscCyclesPerNs();
+  state.counters["p50_ns"] = histogram.percentile(0.5) / ratio;
+  state.counters["p99_ns"] = histogram.percentile(0.99) / ratio;
+  state.counters["p99.9_ns"] = histogram.percentile(0.999) / ratio;
+  state.counters["reads"] = benchmark::Counter(reads.load(), benchmark::Counter::kIsRate);
+  state.counters["retries"] = buffer.retries();
+  state.counters["inconsistent"] = inconsistent.load();
+  state.SetItemsProcessed(state.iterations());
+}
+
+//consolidated touch of the venue books by a scan of their get_tob, NaN price and zero qty when no venue quotes
+static std::pair<price_t, uint64_t> scanTouch(const std::vector<std::unique_ptr<book_t>>& books, SideType side)
+{
+  price_t best = std::numeric_limits<double>::quiet_NaN();
+  uint64_t qty = 0;
+  for(auto& book : books)
+  {
+    auto price = book->get_tob(side);
+    if(std::isnan(price))
+    {
+      continue;
+    }
+
+    uint64_t level_qty = 0;
+    book->visit_levels(side, 1, [&level_qty](price_t, uint64_t qty) { level_qty += qty; });
+    if(std::isnan(best) || (side == SideType::bid ? price > best : price < best))
+    {
+      best = price;
+      qty = level_qty;
+    }
+    else if(price == best)
+    {
+      qty += level_qty;
+    }
+  }
+  return std::make_pair(best, qty);
+}
+
+//one stream interleaving the messages of state.range(0) venues, the consolidated touch is read after every message
+//from the tournament trees of a ConsolidatedBook, or with state.range(1) set by polling get_tob on every venue.
+//the stream is first replayed untimed through a ConsolidatedBook checked against a scan of the venues after
+//every message, any difference is reported in the mismatches counter and fails the run
+static void BM_CONSOLIDATED_BOOK_NBBO(benchmark::State& state)
+{
+  const uint32_t num_venues = state.range(0);
+  const bool polling = state.range(1);
+
+  std::vector<InvalidStats> stats(num_venues);
+  std::vector<std::unique_ptr<book_t>> books(num_venues);
+  std::vector<std::vector<Message>> prefills(num_venues);
+  std::vector<std::pair<uint32_t, Message>> stream;
+  {
+    std::vector<std::unique_ptr<MessageGenerator>> generators;
+    for(uint32_t venue = 0; venue < num_venues; ++venue)
+    {
+      GeneratorConfig config;
+      config.seed = venue + 1;
+      config.mid_price = 1000;
+      generators.emplace_back(new MessageGenerator(config));
+      generators.back()->prefill(prefills[venue]);
+    }
+
+    Rng rng(42);
+    stream.reserve(kStreamSize);
+    for(size_t i = 0; i < kStreamSize; ++i)
+    {
+      auto venue = rng.uniform(num_venues);
+      stream.emplace_back(venue, generators[venue]->next());
+    }
   }
+
+  std::unique_ptr<ConsolidatedBook<book_t>> consolidated;
+  auto rebuild = [&](bool tree)
+  {
+    consolidated.reset();
+    for(uint32_t venue = 0; venue < num_venues; ++venue)
+    {
+      stats[venue] = InvalidStats();
+      books[venue].reset(new book_t(stats[venue]));
+      for(auto& msg : prefills[venue])
+      {
+        applyMessage(*books[venue], msg);
+      }
+    }
+
+    if(tree)
+    {
+      consolidated.reset(new ConsolidatedBook<book_t>(num_venues));
+      for(auto& book : books)
+      {
+        consolidated->add_venue(*book);
+      }
+    }
+  };
+
+  uint64_t mismatches = 0;
+  rebuild(true);
+  for(auto& entry : stream)
+  {
+    applyMessage(*books[entry.first], entry.second);
+    for(auto side : {SideType::bid, SideType::ask})
+    {
+      auto expected = scanTouch(books, side);
+      auto price = consolidated->best_price(side);
+      if(!(price == expected.first || (std::isnan(price) && std::isnan(expected.first))) ||
+            consolidated->best_qty(side) != expected.second)
+      {
+        ++mismatches;
+      }
+    }
+  }
+  state.counters["mismatches"] = mismatches;
+  if(mismatches)
+  {
+    state.SkipWithError("consolidated touch differs from a scan of the venues");
+    return;
+  }
+  rebuild(!polling);
+
+  size_t index = 0;
+  for (auto _ : state)
+  {
+    if(UNLIKELY(index == stream.size()))
+    {
+      state.PauseTiming();
+      rebuild(!polling);
+      index = 0;
+      state.ResumeTiming();
+    }
+
+    auto& entry = stream[index++];
+    applyMessage(*books[entry.first], entry.second);
+    if(polling)
+    {
+      price_t best_bid = -std::numeric_limits<double>::infinity();
+      price_t best_ask = std::numeric_limits<double>::infinity();
+      for(auto& book : books)
+      {
+        best_bid = std::max(best_bid, book->get_tob(SideType::bid));
+        best_ask = std::min(best_ask, book->get_tob(SideType::ask));
+      }
+      benchmark::DoNotOptimize(best_bid);
+      benchmark::DoNotOptimize(best_ask);
+    }
+    else
+    {
+      benchmark::DoNotOptimize(consolidated->best_price(SideType::bid));
+      benchmark::DoNotOptimize(consolidated->best_price(SideType::ask));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+//levels per side, resting orders, price distribution
+static void BookShapes(benchmark::internal::Benchmark* bench)
+{
+  bench->ArgNames({"depth", "resting", "dist"})->ArgsProduct({{10, 1000}, {1000, 100000}, {0, 1, 2}});
+}
+
+//levels per side, resting orders, price distribution, message mix
+static void BookShapesAndMixes(benchmark::internal::Benchmark* bench)
+{
+  bench->ArgNames({"depth", "resting", "dist", "mix"})->ArgsProduct({{10, 1000}, {1000, 100000}, {0, 1, 2}, {0, 1, 2}});
 }
 
-BENCHMARK(BM_ORDER_BOOK_ADD_ORDER)->UseRealTime()->MinTime(0.0001);
-BENCHMARK(BM_ORDER_BOOK_AMEND_ORDER)->UseRealTime()->MinTime(0.0001);
-BENCHMARK(BM_ORDER_BOOK_CANCEL_ORDER)->UseRealTime()->MinTime(0.00005);
+BENCHMARK_REGISTER_F(OrderBookFixture, BM_ORDER_BOOK_ADD_ORDER)->Apply(BookShapes);
+BENCHMARK_REGISTER_F(OrderBookFixture, BM_ORDER_BOOK_AMEND_ORDER)->Apply(BookShapes);
+BENCHMARK_REGISTER_F(OrderBookFixture, BM_ORDER_BOOK_CANCEL_ORDER)->Apply(BookShapes);
+BENCHMARK_REGISTER_F(OrderBookFixture, BM_ORDER_BOOK_MESSAGE_MIX)->Apply(BookShapesAndMixes);
+BENCHMARK_REGISTER_F(OrderBookFixture, BM_ORDER_BOOK_OP_LATENCY)->Apply(BookShapesAndMixes);
+BENCHMARK(BM_FEED_HANDLER_REPLAY)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_FEED_READER_FRAMING)->ArgName("reader")->DenseRange(0, 4)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_FEED_READER_REPLAY)->ArgName("reader")->DenseRange(0, 4)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_INTERLEAVED_REPLAY)->ArgNames({"mode", "books", "resting"})
+      ->ArgsProduct({benchmark::CreateDenseRange(0, kNumReplayModes - 1, 1), {1, 4, 16, 64}, {1000, 100000}})->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ORDER_BOOK_CHECKPOINT_RESTORE)->Arg(100000)->Arg(2000000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_EVENT_TRACER_RECORD);
+BENCHMARK(BM_SHM_PUBLISH_TO_READ)->UseRealTime();
+BENCHMARK(BM_BOOK_SNAPSHOT_READERS)->ArgNames({"publish", "readers"})
+      ->Args({0, 0})->Args({1, 0})->Args({1, 1})->Args({1, 2})->Args({1, 4})->Args({1, 8})->UseRealTime();
+BENCHMARK(BM_CONSOLIDATED_BOOK_NBBO)->ArgNames({"venues", "polling"})->ArgsProduct({{2, 8, 32}, {0, 1}});
 
-BENCHMARK_MAIN()
+BENCHMARK_MAIN();
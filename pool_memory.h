@@ -0,0 +1,291 @@
+#pragma once
+
+#include "utils.h"
+#include "alloc_guard.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+//NUMA placement needs libnuma, detected by cmake which then defines ORDER_BOOK_HAVE_NUMA
+#ifdef ORDER_BOOK_HAVE_NUMA
+#include <numa.h>
+#endif
+
+namespace order_book
+{
+  enum class HugePageMode : uint8_t
+  {
+    //regular 4K pages
+    off,
+    //2MB aligned anonymous mappings advised with MADV_HUGEPAGE
+    thp,
+    //MAP_HUGETLB mappings from the reserved huge page pool, thp when none is left
+    hugetlb
+  };
+
+  inline const char* ToStr(HugePageMode mode)
+  {
+    switch(mode)
+    {
+      case HugePageMode::off:
+        return "off";
+      case HugePageMode::thp:
+        return "thp";
+      case HugePageMode::hugetlb:
+        return "hugetlb";
+      default:
+        return "unknown";
+    }
+  }
+
+  struct PoolMemoryStats
+  {
+    //mapped chunks and bytes by backing
+    uint64_t hugetlb_chunks = 0;
+    uint64_t hugetlb_bytes = 0;
+    uint64_t thp_chunks = 0;
+    uint64_t thp_bytes = 0;
+    uint64_t small_page_chunks = 0;
+    uint64_t small_page_bytes = 0;
+    //bytes handed out to the pools
+    uint64_t used_bytes = 0;
+  };
+
+  //boost pool UserAllocator behind the order, level and index pools. until configure is called it forwards to
+  //new/delete. once configured, pool blocks are carved out of 2MB aligned chunks, backed by huge pages unless the
+  //mode is off and optionally bound to a NUMA node, so a whole book lives on few large pages. pools only return
+  //blocks when a book is destroyed, so carved memory is kept until exit instead of being reused
+  template<typename tag_t = void>
+  class PoolMemory
+  {
+    public:
+
+      typedef std::size_t size_type;
+      typedef std::ptrdiff_t difference_type;
+
+      static constexpr size_t kHugePageSize = 2 << 20;
+
+      //must be called before the first pool block is allocated, numa_node -1 leaves the placement to the kernel
+      static void configure(HugePageMode mode, int numa_node = -1)
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        assert(stats_.used_bytes == 0);
+        mode_ = mode;
+        numa_node_ = numa_node;
+        configured_ = true;
+      }
+
+      static HugePageMode mode()
+      {
+        return mode_;
+      }
+
+      static char* malloc(const size_type bytes)
+      {
+        if(!configured_)
+        {
+          return new (std::nothrow) char[bytes];
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        //keep the blocks cache line aligned
+        const size_t size = (bytes + 63) & ~size_t(63);
+        if(static_cast<size_t>(chunk_end_ - chunk_cur_) < size && !mapChunk(size))
+        {
+          return nullptr;
+        }
+
+        //carved blocks bypass operator new, a pool growing on the message path is reported here instead
+        ALLOC_GUARD_ALLOCATION();
+        char* block = chunk_cur_;
+        chunk_cur_ += size;
+        stats_.used_bytes += size;
+        return block;
+      }
+
+      static void free(char* const block)
+      {
+        if(!configured_)
+        {
+          delete [] block;
+        }
+      }
+
+      static PoolMemoryStats stats()
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+      }
+
+    private:
+
+      //called with mutex_ held, the rest of the current chunk is abandoned
+      static bool mapChunk(size_t size)
+      {
+        const size_t chunk_size = (size + kHugePageSize - 1) & ~(kHugePageSize - 1);
+        char* chunk = nullptr;
+
+        if(mode_ == HugePageMode::hugetlb)
+        {
+          void* addr = ::mmap(nullptr, chunk_size, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+          if(addr != MAP_FAILED)
+          {
+            chunk = static_cast<char*>(addr);
+            ++stats_.hugetlb_chunks;
+            stats_.hugetlb_bytes += chunk_size;
+          }
+        }
+
+        if(!chunk)
+        {
+          //over map by a huge page and trim both ends so the chunk is 2MB aligned, thp only backs aligned ranges
+          void* addr = ::mmap(nullptr, chunk_size + kHugePageSize, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+          if(addr == MAP_FAILED)
+          {
+            return false;
+          }
+
+          char* begin = static_cast<char*>(addr);
+          chunk = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(begin) + kHugePageSize - 1) & ~(kHugePageSize - 1));
+          if(chunk != begin)
+          {
+            ::munmap(begin, chunk - begin);
+          }
+          ::munmap(chunk + chunk_size, begin + kHugePageSize - chunk);
+
+          if(mode_ != HugePageMode::off && ::madvise(chunk, chunk_size, MADV_HUGEPAGE) == 0)
+          {
+            ++stats_.thp_chunks;
+            stats_.thp_bytes += chunk_size;
+          }
+          else
+          {
+            ++stats_.small_page_chunks;
+            stats_.small_page_bytes += chunk_size;
+          }
+        }
+
+#ifdef ORDER_BOOK_HAVE_NUMA
+        if(numa_node_ >= 0 && numa_available() >= 0)
+        {
+          numa_tonode_memory(chunk, chunk_size, numa_node_);
+        }
+#endif
+
+        chunk_cur_ = chunk;
+        chunk_end_ = chunk + chunk_size;
+        return true;
+      }
+
+    private:
+
+      static bool configured_;
+      static HugePageMode mode_;
+      static int numa_node_;
+      static std::mutex mutex_;
+      static char* chunk_cur_;
+      static char* chunk_end_;
+      static PoolMemoryStats stats_;
+  };
+
+  template<typename tag_t>
+  bool PoolMemory<tag_t>::configured_ = false;
+
+  template<typename tag_t>
+  HugePageMode PoolMemory<tag_t>::mode_ = HugePageMode::off;
+
+  template<typename tag_t>
+  int PoolMemory<tag_t>::numa_node_ = -1;
+
+  template<typename tag_t>
+  std::mutex PoolMemory<tag_t>::mutex_;
+
+  template<typename tag_t>
+  char* PoolMemory<tag_t>::chunk_cur_ = nullptr;
+
+  template<typename tag_t>
+  char* PoolMemory<tag_t>::chunk_end_ = nullptr;
+
+  template<typename tag_t>
+  PoolMemoryStats PoolMemory<tag_t>::stats_;
+
+  //NUMA node of the cpu, -1 when unknown or without libnuma
+  inline int numaNodeOfCpu(int cpu)
+  {
+#ifdef ORDER_BOOK_HAVE_NUMA
+    if(numa_available() >= 0)
+    {
+      return numa_node_of_cpu(cpu);
+    }
+#endif
+    (void)cpu;
+    return -1;
+  }
+
+  inline bool pinCurrentThread(int cpu)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return ::sched_setaffinity(0, sizeof(set), &set) == 0;
+  }
+
+  //size of a field of /proc/self/smaps_rollup in kB, 0 when it cannot be read
+  inline uint64_t readSmapsRollupKb(const char* field)
+  {
+    FILE* file = std::fopen("/proc/self/smaps_rollup", "r");
+    if(!file)
+    {
+      return 0;
+    }
+
+    const size_t field_len = std::strlen(field);
+    char line[256];
+    unsigned long long value = 0;
+    while(std::fgets(line, sizeof(line), file))
+    {
+      if(std::strncmp(line, field, field_len) == 0 && line[field_len] == ':')
+      {
+        std::sscanf(line + field_len + 1, "%llu", &value);
+        break;
+      }
+    }
+
+    std::fclose(file);
+    return value;
+  }
+
+  //pool backing and the page / scheduling counters the huge pages and the pinning are meant to improve
+  template<typename stream_t>
+  void printPoolMemoryStats(stream_t& os)
+  {
+    auto stats = PoolMemory<>::stats();
+    os << "*** Pool memory (" << ToStr(PoolMemory<>::mode()) << ") ***\n";
+    os << "hugetlb : " << stats.hugetlb_chunks << " chunks " << (stats.hugetlb_bytes >> 20) << " MB "
+       << (stats.hugetlb_bytes / PoolMemory<>::kHugePageSize) << " pages of 2MB\n";
+    os << "thp : " << stats.thp_chunks << " chunks " << (stats.thp_bytes >> 20) << " MB advised, "
+       << (readSmapsRollupKb("AnonHugePages") >> 10) << " MB of the process backed by huge pages\n";
+    os << "4K pages : " << stats.small_page_chunks << " chunks " << (stats.small_page_bytes >> 20) << " MB\n";
+    os << "pool blocks : " << (stats.used_bytes >> 10) << " kB\n";
+
+    struct rusage usage;
+    if(::getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+      os << "minor faults " << usage.ru_minflt << " major faults " << usage.ru_majflt
+         << " voluntary switches " << usage.ru_nvcsw << " involuntary switches " << usage.ru_nivcsw << "\n";
+    }
+    os << "running on cpu " << ::sched_getcpu() << "\n";
+  }
+}
@@ -0,0 +1,231 @@
+#pragma once
+
+#include "feed_handler.h"
+#include "book_checkpoint.h"
+#include "feed_reader.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace order_book
+{
+  constexpr uint32_t kReplayIndexMagic = 0x5849424f; //"OBIX"
+  constexpr uint32_t kReplayIndexVersion = 2;
+
+  //sidecar index of a feed file: handler checkpoints every N messages followed by the entry table and a footer
+  //
+  //  [checkpoint image]...[ReplayIndexEntry]...[ReplayIndexFooter]
+  //
+  //seek loads the closest checkpoint at or before the requested message and replays at most N-1 messages
+  struct ReplayIndexEntry
+  {
+    //number of messages applied in the checkpoint
+    uint64_t msg_number = 0;
+    //byte offset of the next message in the feed file
+    uint64_t feed_offset = 0;
+    uint64_t image_offset = 0;
+    uint64_t image_size = 0;
+  };
+
+  struct ReplayIndexFooter
+  {
+    uint32_t magic = kReplayIndexMagic;
+    uint32_t version = kReplayIndexVersion;
+    uint64_t interval = 0;
+    uint64_t num_msgs = 0;
+    uint64_t num_entries = 0;
+    uint64_t table_offset = 0;
+    //the indexed feed file, seek refuses any other
+    FeedIdentity feed;
+  };
+
+  class ReplayIndex
+  {
+    public:
+
+      //replay the whole feed once and write the index, interval is the number of messages between checkpoints
+      static bool build(const char* feed_path, const char* index_path, uint64_t interval)
+      {
+        assert(interval > 0);
+
+        FeedIdentity identity;
+        FeedReader reader;
+        if(!readFeedIdentity(feed_path, identity) || !reader.open(feed_path))
+        {
+          return false;
+        }
+
+        const std::string temp_path = std::string(index_path) + ".tmp";
+        FILE* file = std::fopen(temp_path.c_str(), "wb");
+        if(!file)
+        {
+          return false;
+        }
+
+        FeedHandler feed;
+        CheckpointWriter writer;
+        std::vector<ReplayIndexEntry> entries;
+        uint64_t image_offset = 0;
+        uint64_t feed_offset = 0;
+        bool ok = true;
+
+        auto add_entry = [&]()
+        {
+          writer.clear();
+          feed.saveCheckpoint(writer, feed_offset, identity);
+
+          ReplayIndexEntry entry;
+          entry.msg_number = feed.numMessages();
+          entry.feed_offset = feed_offset;
+          entry.image_offset = image_offset;
+          entry.image_size = writer.size();
+          entries.push_back(entry);
+
+          ok = ok && std::fwrite(writer.data(), 1, writer.size(), file) == writer.size();
+          image_offset += writer.size();
+        };
+
+        add_entry();
+
+        const char* line = nullptr;
+        size_t size = 0;
+        while(ok && reader.next_line(line, size))
+        {
+          feed.processMessage(line, size);
+          feed_offset = reader.offset();
+          if(feed.numMessages() % interval == 0)
+          {
+            add_entry();
+          }
+        }
+
+        ok = ok && reader.ok();
+
+        ReplayIndexFooter footer;
+        footer.interval = interval;
+        footer.num_msgs = feed.numMessages();
+        footer.num_entries = entries.size();
+        footer.table_offset = image_offset;
+        footer.feed = identity;
+
+        ok = ok && std::fwrite(entries.data(), sizeof(ReplayIndexEntry), entries.size(), file) == entries.size();
+        ok = ok && std::fwrite(&footer, sizeof(footer), 1, file) == 1;
+        ok = (std::fclose(file) == 0) && ok;
+        if(!ok || std::rename(temp_path.c_str(), index_path) != 0)
+        {
+          std::remove(temp_path.c_str());
+          return false;
+        }
+
+        return true;
+      }
+
+      ReplayIndex() {}
+      ReplayIndex(const ReplayIndex&) = delete;
+      ReplayIndex& operator=(const ReplayIndex&) = delete;
+
+      ~ReplayIndex()
+      {
+        if(file_)
+        {
+          std::fclose(file_);
+        }
+      }
+
+      //load the entry table, the checkpoint images are read on demand by seek
+      bool open(const char* index_path)
+      {
+        assert(!file_);
+
+        file_ = std::fopen(index_path, "rb");
+        if(!file_)
+        {
+          return false;
+        }
+
+        long footer_offset = -1;
+        if(std::fseek(file_, 0, SEEK_END) == 0)
+        {
+          footer_offset = std::ftell(file_) - static_cast<long>(sizeof(ReplayIndexFooter));
+        }
+
+        if(footer_offset < 0 || std::fseek(file_, footer_offset, SEEK_SET) != 0 ||
+              std::fread(&footer_, sizeof(footer_), 1, file_) != 1 ||
+              footer_.magic != kReplayIndexMagic || footer_.version != kReplayIndexVersion || footer_.num_entries == 0 ||
+              footer_.table_offset + footer_.num_entries * sizeof(ReplayIndexEntry) != static_cast<uint64_t>(footer_offset))
+        {
+          return false;
+        }
+
+        entries_.resize(footer_.num_entries);
+        return std::fseek(file_, footer_.table_offset, SEEK_SET) == 0 &&
+                std::fread(entries_.data(), sizeof(ReplayIndexEntry), entries_.size(), file_) == entries_.size();
+      }
+
+      //number of messages in the indexed feed
+      uint64_t num_msgs() const
+      {
+        return footer_.num_msgs;
+      }
+
+      //whether the feed file is still the one the index was built from
+      bool matches(const char* feed_path) const
+      {
+        FeedIdentity identity;
+        return readFeedIdentity(feed_path, identity) && identity == footer_.feed;
+      }
+
+      //bring a freshly constructed handler to the state right after msg_number messages of the feed
+      //cost is bounded by one checkpoint load plus at most interval - 1 replayed messages
+      bool seek(const char* feed_path, uint64_t msg_number, FeedHandler& feed) const
+      {
+        assert(file_);
+        if(msg_number > footer_.num_msgs || !matches(feed_path))
+        {
+          return false;
+        }
+
+        auto iter = std::upper_bound(entries_.begin(), entries_.end(), msg_number,
+              [](uint64_t number, const ReplayIndexEntry& entry) { return number < entry.msg_number; });
+        assert(iter != entries_.begin());
+        auto& entry = *(--iter);
+
+        std::vector<char> image(entry.image_size);
+        if(std::fseek(file_, entry.image_offset, SEEK_SET) != 0 ||
+              std::fread(image.data(), 1, image.size(), file_) != image.size())
+        {
+          return false;
+        }
+
+        CheckpointReader reader(image.data(), image.size());
+        uint64_t feed_offset = 0;
+        if(!feed.loadCheckpoint(reader, feed_offset, footer_.feed) || feed.numMessages() != entry.msg_number)
+        {
+          return false;
+        }
+
+        FeedReader feed_reader;
+        if(!feed_reader.open(feed_path, feed_offset))
+        {
+          return false;
+        }
+
+        const char* line = nullptr;
+        size_t size = 0;
+        while(feed.numMessages() < msg_number && feed_reader.next_line(line, size))
+        {
+          feed.processMessage(line, size);
+        }
+
+        return feed.numMessages() == msg_number;
+      }
+
+    private:
+
+      FILE* file_ = nullptr;
+      ReplayIndexFooter footer_;
+      std::vector<ReplayIndexEntry> entries_;
+  };
+}
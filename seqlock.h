@@ -0,0 +1,83 @@
+#pragma once
+
+#include "utils.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace order_book
+{
+  //attempts of SeqLock::read before it reports the writer as stuck, far longer than any write takes
+  constexpr uint64_t kSeqLockMaxRetries = 1 << 20;
+
+  //single writer sequence lock around a trivially copyable payload
+  //the writer never waits, readers copy the payload and retry if a write overlapped the copy
+  //the layout is address free so it can live in a shared memory segment
+  template<typename data_t>
+  struct alignas(64) SeqLock
+  {
+    static_assert(std::is_trivially_copyable<data_t>::value, "seqlock payload must be trivially copyable");
+
+    template<typename func_t>
+    void write(func_t&& func)
+    {
+      auto seq = seq_.load(std::memory_order_relaxed);
+      //odd sequence marks the write in progress
+      seq_.store(seq + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+
+      func(data_);
+
+      seq_.store(seq + 2, std::memory_order_release);
+    }
+
+    //single attempt, return false if the copy is torn by a concurrent write
+    bool try_read(data_t& out) const
+    {
+      auto seq1 = seq_.load(std::memory_order_acquire);
+      if(UNLIKELY(seq1 & 1))
+      {
+        return false;
+      }
+
+      std::memcpy(&out, &data_, sizeof(data_t));
+      std::atomic_thread_fence(std::memory_order_acquire);
+
+      return seq_.load(std::memory_order_relaxed) == seq1;
+    }
+
+    //spin until a consistent copy is taken and set seq to its sequence. gives up and returns false after
+    //max_retries torn attempts, as a writer that died in the middle of a write leaves the sequence odd for good
+    bool read(data_t& out, uint64_t& seq, uint64_t max_retries = kSeqLockMaxRetries) const
+    {
+      for(uint64_t attempt = 0; attempt <= max_retries; ++attempt)
+      {
+        auto seq1 = seq_.load(std::memory_order_acquire);
+        if(UNLIKELY(seq1 & 1))
+        {
+          continue;
+        }
+
+        std::memcpy(&out, &data_, sizeof(data_t));
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if(LIKELY(seq_.load(std::memory_order_relaxed) == seq1))
+        {
+          seq = seq1;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    uint64_t sequence() const
+    {
+      return seq_.load(std::memory_order_acquire);
+    }
+
+    std::atomic<uint64_t> seq_ = {0};
+    data_t data_;
+  };
+}
@@ -0,0 +1,247 @@
+#pragma once
+
+#include "types.h"
+#include "seqlock.h"
+
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace order_book
+{
+  //number of price levels published per side
+  constexpr uint32_t kShmBookDepth = 10;
+  constexpr uint64_t kShmBookMagic = 0x4b4f4f42524444ULL;
+  constexpr uint32_t kShmBookVersion = 1;
+
+  struct ShmLevel
+  {
+    price_t price = 0;
+    uint64_t qty = 0;
+  };
+
+  //consistent view of one book, level 0 of each side is the bbo
+  struct ShmBookSnapshot
+  {
+    uint64_t msg_seq = 0;
+    //steady clock time of the write, comparable across processes on the same host
+    uint64_t publish_ns = 0;
+
+    uint32_t num_levels[static_cast<int>(SideType::cardinality)] = {0, 0};
+    ShmLevel levels[static_cast<int>(SideType::cardinality)][kShmBookDepth];
+
+    price_t last_trade_price = 0;
+    qty_t last_trade_qty = 0;
+
+    InvalidStats invalid_stats;
+  };
+
+  static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "seqlock sequence must be lock free to be shared across processes");
+
+  using ShmBookSlot = SeqLock<ShmBookSnapshot>;
+
+  struct alignas(64) ShmSegmentHeader
+  {
+    uint64_t magic = 0;
+    uint32_t version = 0;
+    uint32_t depth = 0;
+    uint32_t num_books = 0;
+  };
+
+  inline size_t shmSegmentSize(uint32_t num_books)
+  {
+    return sizeof(ShmSegmentHeader) + sizeof(ShmBookSlot) * num_books;
+  }
+
+  inline uint64_t steadyNowNs()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  //creates the segment and owns the write side of every book slot in it
+  class ShmBookWriter
+  {
+    public:
+
+      ShmBookWriter() {}
+      ShmBookWriter(const ShmBookWriter&) = delete;
+      ShmBookWriter& operator=(const ShmBookWriter&) = delete;
+
+      ~ShmBookWriter()
+      {
+        if(base_)
+        {
+          munmap(base_, size_);
+        }
+      }
+
+      //create the named segment, return false if it cannot be created or mapped
+      //a segment left by a previous writer is unlinked rather than resized: readers still mapping it keep the
+      //old pages instead of faulting past the end of a shrunk one, and attach to the new segment on reopen
+      bool open(const char* name, uint32_t num_books)
+      {
+        assert(!base_ && num_books > 0);
+
+        if(shm_unlink(name) != 0 && errno != ENOENT)
+        {
+          return false;
+        }
+
+        int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+        if(fd < 0)
+        {
+          return false;
+        }
+
+        size_ = shmSegmentSize(num_books);
+        if(ftruncate(fd, size_) != 0)
+        {
+          close(fd);
+          return false;
+        }
+
+        void* addr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if(addr == MAP_FAILED)
+        {
+          return false;
+        }
+
+        base_ = static_cast<char*>(addr);
+        auto header = new (base_) ShmSegmentHeader();
+        slots_ = reinterpret_cast<ShmBookSlot*>(base_ + sizeof(ShmSegmentHeader));
+        for(uint32_t i = 0; i < num_books; ++i)
+        {
+          new (&slots_[i]) ShmBookSlot();
+        }
+
+        //readers check the magic, so publish the header only once the slots are ready
+        header->version = kShmBookVersion;
+        header->depth = kShmBookDepth;
+        header->num_books = num_books;
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = kShmBookMagic;
+
+        num_books_ = num_books;
+        return true;
+      }
+
+      //fill the book snapshot in place under the seqlock
+      template<typename func_t>
+      void publish(uint32_t book, func_t&& func)
+      {
+        assert(book < num_books_);
+        slots_[book].write([&](ShmBookSnapshot& snapshot)
+        {
+          func(snapshot);
+          snapshot.publish_ns = steadyNowNs();
+        });
+      }
+
+      static bool unlink(const char* name)
+      {
+        return shm_unlink(name) == 0;
+      }
+
+    private:
+
+      char* base_ = nullptr;
+      size_t size_ = 0;
+      ShmBookSlot* slots_ = nullptr;
+      uint32_t num_books_ = 0;
+  };
+
+  //read only mapping of a segment created by ShmBookWriter, any number of readers can attach
+  class ShmBookReader
+  {
+    public:
+
+      ShmBookReader() {}
+      ShmBookReader(const ShmBookReader&) = delete;
+      ShmBookReader& operator=(const ShmBookReader&) = delete;
+
+      ~ShmBookReader()
+      {
+        if(base_)
+        {
+          munmap(base_, size_);
+        }
+      }
+
+      //return false if the segment does not exist or was written by an incompatible writer
+      bool open(const char* name)
+      {
+        assert(!base_);
+
+        int fd = shm_open(name, O_RDONLY, 0);
+        if(fd < 0)
+        {
+          return false;
+        }
+
+        struct stat st;
+        if(fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(ShmSegmentHeader))
+        {
+          close(fd);
+          return false;
+        }
+
+        size_ = st.st_size;
+        void* addr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if(addr == MAP_FAILED)
+        {
+          return false;
+        }
+
+        base_ = static_cast<char*>(addr);
+        auto header = reinterpret_cast<const ShmSegmentHeader*>(base_);
+        if(header->magic != kShmBookMagic || header->version != kShmBookVersion ||
+              header->depth != kShmBookDepth || size_ < shmSegmentSize(header->num_books))
+        {
+          munmap(base_, size_);
+          base_ = nullptr;
+          return false;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        num_books_ = header->num_books;
+        slots_ = reinterpret_cast<const ShmBookSlot*>(base_ + sizeof(ShmSegmentHeader));
+        return true;
+      }
+
+      uint32_t num_books() const
+      {
+        return num_books_;
+      }
+
+      //copy a consistent snapshot of the book and set seq to its sequence, never blocks the writer. false when
+      //the slot stayed mid-write for max_retries attempts, e.g. the writer died while publishing
+      bool read(uint32_t book, ShmBookSnapshot& out, uint64_t& seq, uint64_t max_retries = kSeqLockMaxRetries) const
+      {
+        assert(book < num_books_);
+        return slots_[book].read(out, seq, max_retries);
+      }
+
+      //sequence of the book slot, changes on every publish
+      uint64_t sequence(uint32_t book) const
+      {
+        assert(book < num_books_);
+        return slots_[book].sequence();
+      }
+
+    private:
+
+      char* base_ = nullptr;
+      size_t size_ = 0;
+      const ShmBookSlot* slots_ = nullptr;
+      uint32_t num_books_ = 0;
+  };
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "shm_book.h"
+#include "seqlock.h"
+
+#include <atomic>
+#include <cstdint>
+
+namespace order_book
+{
+  //in process counterpart of the shared memory book: strategy threads read a consistent top of book and depth
+  //while the feed thread keeps mutating the book, which is never touched by the readers
+  //two seqlock slots are published alternately and the epoch names the last complete one. the writer fills the
+  //slot the readers are not sent to, so a copy is only retried when the writer published twice during it, and
+  //the writer never waits for a reader
+  class BookSnapshotBuffer
+  {
+    public:
+
+      BookSnapshotBuffer() {}
+      BookSnapshotBuffer(const BookSnapshotBuffer&) = delete;
+      BookSnapshotBuffer& operator=(const BookSnapshotBuffer&) = delete;
+
+      //single writer, fill the next snapshot in place then make it current
+      template<typename func_t>
+      void publish(func_t&& func)
+      {
+        auto epoch = epoch_.load(std::memory_order_relaxed) + 1;
+        slots_[epoch & 1].write([&](ShmBookSnapshot& snapshot)
+        {
+          func(snapshot);
+          snapshot.publish_ns = steadyNowNs();
+        });
+        epoch_.store(epoch, std::memory_order_release);
+      }
+
+      //copy the current snapshot, return its epoch. never blocks the writer, any number of readers
+      uint64_t read(ShmBookSnapshot& out) const
+      {
+        while(true)
+        {
+          auto epoch = epoch_.load(std::memory_order_acquire);
+          if(LIKELY(slots_[epoch & 1].try_read(out)))
+          {
+            return epoch;
+          }
+          retries_.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+
+      //number of publishes so far, changes on every publish
+      uint64_t epoch() const
+      {
+        return epoch_.load(std::memory_order_acquire);
+      }
+
+      //copies torn by the writer lapping a reader, summed over the readers
+      uint64_t retries() const
+      {
+        return retries_.load(std::memory_order_relaxed);
+      }
+
+    private:
+
+      SeqLock<ShmBookSnapshot> slots_[2];
+      alignas(64) std::atomic<uint64_t> epoch_ = {0};
+      alignas(64) mutable std::atomic<uint64_t> retries_ = {0};
+  };
+}
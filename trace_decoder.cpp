@@ -0,0 +1,99 @@
+/**
+Decode a binary trace written by EventTracer into one readable line per event
+**/
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#include "event_tracer.h"
+
+using namespace order_book;
+
+//shortest form strtod reads back as the same double, %g alone would merge close levels of large prices
+static const char* formatPrice(char (&out)[32], double price)
+{
+  for(int precision = 15; precision < 17; ++precision)
+  {
+    std::snprintf(out, sizeof(out), "%.*g", precision, price);
+    if(std::strtod(out, nullptr) == price)
+    {
+      return out;
+    }
+  }
+
+  std::snprintf(out, sizeof(out), "%.17g", price);
+  return out;
+}
+
+int main(int argc, char **argv)
+{
+  if(argc != 2)
+  {
+    std::cerr << "Usage: " << argv[0] << " <trace file>" << std::endl;
+    return -1;
+  }
+
+  FILE* file = std::fopen(argv[1], "rb");
+  if(!file)
+  {
+    std::cerr << "Failed to open trace file " << argv[1] << std::endl;
+    return -1;
+  }
+
+  TraceFileHeader header;
+  if(std::fread(&header, sizeof(header), 1, file) != 1 || 
+        header.magic != kTraceMagic || header.version != kTraceVersion)
+  {
+    std::cerr << "Not a trace file " << argv[1] << std::endl;
+    std::fclose(file);
+    return -1;
+  }
+
+  //events of each thread are in order, threads are interleaved per flush
+  TraceEvent events[4096];
+  size_t count = 0;
+  while((count = std::fread(events, sizeof(TraceEvent), 4096, file)) > 0)
+  {
+    for(size_t i = 0; i < count; ++i)
+    {
+      auto& event = events[i];
+      char price[32];
+      double ns = static_cast<int64_t>(event.tsc - header.start_tsc) / header.cycles_per_ns;
+      std::printf("%.0f t%u %s", ns, event.thread, ToStr(event.type));
+      switch(event.type)
+      {
+        case TraceEventType::level_created:
+        case TraceEventType::level_destroyed:
+        case TraceEventType::top_changed:
+        {
+          std::printf(" %s %s", ToStr(event.side), formatPrice(price, event.price));
+          break;
+        }
+        case TraceEventType::order_add:
+        case TraceEventType::order_amend:
+        case TraceEventType::order_cancel:
+        {
+          std::printf(" %s id %u %u @ %s", ToStr(event.side), event.order_id, event.qty, formatPrice(price, event.price));
+          break;
+        }
+        case TraceEventType::invalid_msg:
+        {
+          std::printf(" %s id %u", ToStr(static_cast<InvalidReason>(event.code)), event.order_id);
+          break;
+        }
+        case TraceEventType::lost:
+        {
+          std::printf(" %u events", event.qty);
+          break;
+        }
+        default:
+          break;
+      }
+      std::printf("\n");
+    }
+  }
+
+  std::fclose(file);
+  return 0;
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+
 namespace order_book
 {
   using order_id_t = uint32_t;
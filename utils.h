@@ -2,10 +2,14 @@
 
 #define LIKELY(x)       __builtin_expect(!!(x),1)
 #define UNLIKELY(x)     __builtin_expect(!!(x),0)
+//prefetch a node about to be written, null pointers are fine
+#define PREFETCH(x)     __builtin_prefetch((x),1,3)
 
+#include <cstdint>
 #include <cstdlib>
 #include <cerrno>
 #include <limits>
+#include <utility>
 
 namespace order_book
 {
@@ -97,7 +101,7 @@ namespace order_book
 
     //parse the c str to a unsigned 32 bit integer until hit the delimiter
     //either return a valid uint32 and begin stop at delimiter or return the max for invalid case
-    uint32_t parseUnsignedField(const char*& begin, char delimiter)
+    inline uint32_t parseUnsignedField(const char*& begin, char delimiter)
     {
       if(UNLIKELY(!(*begin) || (*begin == delimiter)))
       {
@@ -135,7 +139,7 @@ namespace order_book
       return ret;
     };
 
-    double parseDouble(const char*& begin, char delimiter)
+    inline double parseDouble(const char*& begin, char delimiter)
     {
       if(UNLIKELY(!(*begin) || (*begin == delimiter)))
       {